@@ -0,0 +1,180 @@
+#ifndef _TS_LOGGER_CALL_SITE_HPP
+#define _TS_LOGGER_CALL_SITE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace tslogger
+{
+
+// Sampling state of one LOG_EVERY_N / LOG_FIRST_N / LOG_EVERY_MS /
+// LOG_RATE_LIMITED call site. The macros define it as a function-local
+// static with a constexpr constructor, so it needs no initialization guard,
+// and every check is a few relaxed atomic operations done before the
+// arguments are formatted.
+struct SampledSite {
+    constexpr SampledSite(const char *file, int line)
+        : file_{file},
+          line_{line}
+    {
+    }
+
+    SampledSite(const SampledSite &) = delete;
+    SampledSite &operator=(const SampledSite &) = delete;
+
+    // Passes the 1st, (n+1)th, (2n+1)th ... call
+    bool every_n(std::uint64_t n)
+    {
+        const std::uint64_t count = count_.fetch_add(1, std::memory_order_relaxed);
+        return n <= 1 || count % n == 0 || suppress();
+    }
+
+    // Passes the first n calls
+    bool first_n(std::uint64_t n)
+    {
+        return count_.fetch_add(1, std::memory_order_relaxed) < n || suppress();
+    }
+
+    // Passes at most one call per period
+    bool every_ms(std::int64_t ms)
+    {
+        const std::int64_t now = now_ns();
+        std::int64_t next = stamp_.load(std::memory_order_relaxed);
+        if (now >= next && stamp_.compare_exchange_strong(next, now + ms * 1000000, std::memory_order_relaxed)) {
+            return true;
+        }
+        return suppress();
+    }
+
+    // Token bucket of burst tokens refilled at perSecond tokens per second,
+    // implemented as GCRA on a single atomic "theoretical arrival time"
+    bool rate_limited(double perSecond, std::uint32_t burst)
+    {
+        if (perSecond <= 0) {
+            return suppress();
+        }
+        const std::int64_t emission = static_cast<std::int64_t>(1e9 / perSecond);
+        const std::int64_t tolerance = emission * (burst > 0 ? burst - 1 : 0);
+        const std::int64_t now = now_ns();
+        std::int64_t tat = stamp_.load(std::memory_order_relaxed);
+        for (;;) {
+            const std::int64_t base = tat > now ? tat : now;
+            if (base - now > tolerance) {
+                return suppress();
+            }
+            if (stamp_.compare_exchange_weak(tat, base + emission, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    static std::int64_t now_ns()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    const char *file_;
+    int line_;
+    std::atomic<std::uint64_t> count_{0};
+    std::atomic<std::uint64_t> suppressed_{0};
+    // suppressed_ at the time of the last Handler report
+    std::atomic<std::uint64_t> reported_{0};
+    // LOG_EVERY_MS: next allowed time, LOG_RATE_LIMITED: theoretical arrival time
+    std::atomic<std::int64_t> stamp_{0};
+    std::atomic<bool> registered_{false};
+    SampledSite *next_ = nullptr;
+
+private:
+    bool suppress()
+    {
+        suppressed_.fetch_add(1, std::memory_order_relaxed);
+        if (!registered_.load(std::memory_order_relaxed) && !registered_.exchange(true)) {
+            register_site();
+        }
+        return false;
+    }
+
+    // Adds the site to the list returned by sampled_sites(), once
+    void register_site();
+};
+
+// Head of the lock-free list of sites that have suppressed at least one call
+SampledSite *sampled_sites();
+
+enum call_site_state_t : std::uint8_t {
+    // Not called yet, the rules are applied on the first call
+    CALL_SITE_UNREGISTERED,
+    // Filtered by the max level of the handler and its category levels
+    CALL_SITE_DEFAULT,
+    // Written whatever the max level is
+    CALL_SITE_ENABLED,
+    // Not formatted nor queued
+    CALL_SITE_DISABLED,
+};
+
+// Descriptor of one LOG call site. LOG defines it as a function-local static
+// with a constexpr constructor, so it needs no initialization guard; its
+// first call adds it to the list returned by call_sites() and gives it the
+// state of the matching set_call_sites() rules. After that a call costs one
+// relaxed load and a branch before the arguments are formatted.
+struct CallSite {
+    constexpr CallSite(const char *file, int line, const char *function, int level)
+        : file_{file},
+          line_{line},
+          function_{function},
+          level_{level}
+    {
+    }
+
+    CallSite(const CallSite &) = delete;
+    CallSite &operator=(const CallSite &) = delete;
+
+    call_site_state_t state()
+    {
+        const auto state = static_cast<call_site_state_t>(state_.load(std::memory_order_relaxed));
+        return state != CALL_SITE_UNREGISTERED ? state : register_site();
+    }
+
+    const char *file_;
+    int line_;
+    const char *function_;
+    // log_level_t of the first call
+    int level_;
+    std::atomic<std::uint8_t> state_{CALL_SITE_UNREGISTERED};
+    CallSite *next_ = nullptr;
+
+private:
+    call_site_state_t register_site();
+};
+
+// Head of the lock-free list of the sites called so far
+CallSite *call_sites();
+
+// Gives the state to every site whose file matches filePattern and whose
+// function matches functionPattern, now and when more sites are called
+// later; the last matching rule wins. The patterns are globs with '*' and
+// '?'. A file pattern without '/' is matched against the file name only,
+// otherwise against the whole __FILE__ path; null or "" matches anything.
+// Returns the number of sites called so far that match.
+std::size_t set_call_sites(const char *filePattern, const char *functionPattern, call_site_state_t state);
+
+// Drops every rule, all sites go back to CALL_SITE_DEFAULT
+void reset_call_sites();
+
+// Replaces the rules with the lines of a control file:
+//
+// # DEBUG output of the HTTP client
+// enable */net/http_*.cpp
+// disable *.cpp parse_header
+// default db.cpp
+//
+// Returns false, leaving the rules as they are, if a line is not valid
+bool apply_call_site_rules(std::string_view text);
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_CALL_SITE_HPP
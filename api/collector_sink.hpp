@@ -0,0 +1,76 @@
+#ifndef _TS_LOGGER_COLLECTOR_SINK_HPP
+#define _TS_LOGGER_COLLECTOR_SINK_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "stats.hpp"
+
+namespace tslogger
+{
+
+// Sends file lines to a local collector process (tools/tslogger_collector)
+// over a Unix domain stream socket. The collector owns the files: it
+// writes, rotates and flushes them for every process on the host.
+//
+// Lines are framed as
+//
+// filename size (4 bytes) | line size (4 bytes) | filename | line
+//
+// and each process() batch goes out in one send(). The socket is
+// non-blocking: what the collector does not take stays pending, and
+// frames that do not fit in maxPending bytes are dropped. A lost
+// connection is retried at most once per kReconnectDelay, so a collector
+// restart never blocks the handler.
+class CollectorSink {
+public:
+    static constexpr std::size_t kDefaultMaxPending = 4 << 20;
+    static constexpr std::chrono::milliseconds kReconnectDelay{500};
+
+    explicit CollectorSink(std::string socketPath, std::size_t maxPending = kDefaultMaxPending);
+    ~CollectorSink();
+
+    CollectorSink(const CollectorSink &) = delete;
+    CollectorSink(CollectorSink &&) = delete;
+    CollectorSink &operator=(const CollectorSink &) = delete;
+    CollectorSink &operator=(CollectorSink &&) = delete;
+
+    static void append_frame(std::string &batch, std::string_view filename, std::string_view line);
+
+    // Queues the frames of batch (which is cleared) and sends as much of the
+    // pending data as the socket takes. Counts go to the collector sink
+    // counters of the calling thread, frames that are dropped are errors.
+    void send(std::string &batch, std::size_t frames, StatsCounters &counters);
+
+    bool has_pending() const;
+    bool connected() const;
+
+    const std::string &socket_path() const { return m_socketPath_; }
+
+private:
+    // Sends pending data, reconnecting if needed; m_mutex_ is held
+    void flush_pending(StatsCounters &counters);
+    // Drops the frame that was partly sent on a lost connection
+    std::size_t drop_partial_frame();
+
+private:
+    const std::string m_socketPath_;
+    const std::size_t m_maxPending_;
+    mutable std::mutex m_mutex_;
+    int m_fd_;
+    std::chrono::steady_clock::time_point m_nextConnect_;
+    std::string m_pending_;
+    // Bytes of m_pending_ already sent
+    std::size_t m_sent_;
+    // Start of the first frame of m_pending_ not sent in full, a frame
+    // boundary at or before m_sent_
+    std::size_t m_frameStart_;
+};
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_COLLECTOR_SINK_HPP
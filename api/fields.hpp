@@ -0,0 +1,116 @@
+#ifndef _TS_LOGGER_FIELDS_HPP
+#define _TS_LOGGER_FIELDS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "formatter.hpp"
+
+namespace tslogger
+{
+
+// Typed key-value field attached to a message with <<:
+//
+// logger.at(INFO) << "request done\n" << kv("status", 200) << kv("path", path);
+//
+// Only references are kept, the value is encoded when the statement takes it.
+template<typename T>
+struct KeyValue {
+    std::string_view key_;
+    const T &value_;
+};
+
+template<typename T>
+KeyValue<T> kv(std::string_view key, const T &value)
+{
+    return KeyValue<T>{key, value};
+}
+
+// Fields are stored in Message::fields_ as a sequence of records:
+// type (1 byte), key size (1 byte), key, then the value: 8 bytes for numbers,
+// 1 byte for bool, 4-byte size and bytes for strings. Keys longer than 255
+// bytes are cut.
+enum field_type_t : std::uint8_t {
+    FIELD_INT,
+    FIELD_UINT,
+    FIELD_DOUBLE,
+    FIELD_BOOL,
+    FIELD_STRING,
+};
+
+struct FieldView {
+    field_type_t type_;
+    std::string_view key_;
+    std::int64_t int_;
+    std::uint64_t uint_;
+    double double_;
+    bool bool_;
+    std::string_view string_;
+};
+
+namespace text
+{
+
+inline void begin_field(std::string &out, field_type_t type, std::string_view key)
+{
+    const std::size_t keySize = key.size() < 255 ? key.size() : 255;
+    out.push_back(static_cast<char>(type));
+    out.push_back(static_cast<char>(keySize));
+    out.append(key.data(), keySize);
+}
+
+template<typename V>
+void append_field_bytes(std::string &out, V value)
+{
+    char buf[sizeof(V)];
+    std::memcpy(buf, &value, sizeof(V));
+    out.append(buf, sizeof(V));
+}
+
+// Encodes one field. Numbers, bool and strings keep their type, any other
+// value is stored as the string text::append() makes of it.
+template<typename T>
+void append_field(std::string &out, std::string_view key, const T &value, std::size_t maxElements)
+{
+    if constexpr (std::is_same_v<T, bool>) {
+        begin_field(out, FIELD_BOOL, key);
+        out.push_back(value ? 1 : 0);
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        begin_field(out, FIELD_INT, key);
+        append_field_bytes(out, static_cast<std::int64_t>(value));
+    } else if constexpr (std::is_integral_v<T>) {
+        begin_field(out, FIELD_UINT, key);
+        append_field_bytes(out, static_cast<std::uint64_t>(value));
+    } else if constexpr (std::is_floating_point_v<T>) {
+        begin_field(out, FIELD_DOUBLE, key);
+        append_field_bytes(out, static_cast<double>(value));
+    } else {
+        begin_field(out, FIELD_STRING, key);
+        // The size is patched once the text is written in place
+        const std::size_t sizeAt = out.size();
+        append_field_bytes(out, std::uint32_t{0});
+        append(out, value, maxElements);
+        const std::uint32_t size = static_cast<std::uint32_t>(out.size() - sizeAt - sizeof(std::uint32_t));
+        std::memcpy(&out[sizeAt], &size, sizeof(size));
+    }
+}
+
+// Decodes the field at pos and moves pos past it, false at the end or on
+// a truncated record
+bool next_field(std::string_view fields, std::size_t &pos, FieldView &field);
+
+// " key=value" for each field, strings quoted and escaped as in JSON
+void append_fields_text(std::string &out, std::string_view fields);
+
+// ,"key":value for each field
+void append_fields_json(std::string &out, std::string_view fields);
+
+} // namespace text
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_FIELDS_HPP
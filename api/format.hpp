@@ -0,0 +1,123 @@
+#ifndef _TS_LOGGER_FORMAT_HPP
+#define _TS_LOGGER_FORMAT_HPP
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+namespace tslogger::text
+{
+
+// "00" "01" ... "99": two decimal digits per table lookup
+extern const char kDigitPairs[200];
+
+// Elements printed per line by the container formatters
+constexpr std::size_t kElementsPerLine = 16;
+
+char *write_unsigned(char *out, std::uint64_t value);
+char *write_signed(char *out, std::int64_t value);
+char *write_hex(char *out, std::uint64_t value);
+// Shortest round-trip form of the value in its own type, so 0.1f is "0.1"
+char *write_double(char *out, char *last, float value);
+char *write_double(char *out, char *last, double value);
+char *write_double(char *out, char *last, long double value);
+char *write_fixed(char *out, char *last, double value, int precision);
+
+// Upper bound of the characters produced by write_value() for type T
+template<typename T>
+constexpr std::size_t max_chars()
+{
+    if constexpr (std::is_same_v<T, char> || std::is_same_v<T, bool>) {
+        return 1;
+    } else if constexpr (std::is_integral_v<T>) {
+        return std::numeric_limits<T>::digits10 + 2;
+    } else if constexpr (std::is_same_v<T, float>) {
+        // sign, 9 significant digits, point, exponent ("e-45")
+        return 24;
+    } else if constexpr (std::is_same_v<T, double>) {
+        // sign, 17 significant digits, point, exponent ("e-308")
+        return 32;
+    } else {
+        // sign, up to 36 significant digits, point, exponent ("e-4951")
+        return 48;
+    }
+}
+
+template<typename T>
+char *write_value(char *out, T value)
+{
+    static_assert(std::is_arithmetic_v<T>, "only arithmetic types are supported");
+
+    if constexpr (std::is_same_v<T, char>) {
+        *out = value;
+        return out + 1;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        *out = value ? '1' : '0';
+        return out + 1;
+    } else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>) {
+        return write_signed(out, static_cast<std::int64_t>(value));
+    } else if constexpr (std::is_integral_v<T>) {
+        return write_unsigned(out, static_cast<std::uint64_t>(value));
+    } else {
+        return write_double(out, out + max_chars<T>(), value);
+    }
+}
+
+// Appends a single value to the end of out
+template<typename T>
+void append_value(std::string &out, T value)
+{
+    char buf[max_chars<T>()];
+    out.append(buf, write_value(buf, value) - buf);
+}
+
+// Appends value as "0x" followed by lowercase hex digits
+inline void append_hex(std::string &out, std::uint64_t value)
+{
+    char buf[18];
+    out.append(buf, write_hex(buf, value) - buf);
+}
+
+// Appends "{ v0, v1, ... }" with a line break every kElementsPerLine elements.
+// The output is sized once for the worst case and trimmed afterwards, so a
+// sequence of any length costs a single allocation.
+template<typename It>
+void append_sequence(std::string &out, It first, std::size_t count)
+{
+    using T = typename std::iterator_traits<It>::value_type;
+
+    if (count == 0) {
+        out.append("{ }");
+        return;
+    }
+
+    constexpr std::size_t kSeparator = 2; // ", " or " }"
+    const std::size_t bound = 2 + count * (max_chars<T>() + kSeparator) + count / kElementsPerLine;
+    const std::size_t start = out.size();
+    out.resize(start + bound);
+
+    char *p = out.data() + start;
+    *p++ = '{';
+    *p++ = ' ';
+    for (std::size_t i = 0; i < count; ++i) {
+        if (i && i % kElementsPerLine == 0) {
+            *p++ = '\n';
+        }
+        p = write_value(p, static_cast<T>(*first++));
+        if (i + 1 < count) {
+            *p++ = ',';
+            *p++ = ' ';
+        }
+    }
+    *p++ = ' ';
+    *p++ = '}';
+    out.resize(p - out.data());
+}
+
+} // namespace tslogger::text
+
+#endif // _TS_LOGGER_FORMAT_HPP
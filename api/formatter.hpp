@@ -0,0 +1,198 @@
+#ifndef _TS_LOGGER_FORMATTER_HPP
+#define _TS_LOGGER_FORMATTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include "format.hpp"
+#include "hexdump.hpp"
+
+// Maximum number of range elements printed by default, the rest is replaced
+// by "... (+N more)". Can be overridden per Logger with max_elements().
+#ifndef TS_LOGGER_MAX_ELEMENTS
+#define TS_LOGGER_MAX_ELEMENTS 4096
+#endif
+
+namespace tslogger
+{
+
+// Specialization point for user types:
+//
+// template<>
+// struct tslogger::formatter<Point> {
+//     static void format(std::string &out, const Point &p);
+// };
+//
+// format() appends the text to out, which is the message buffer itself.
+template<typename T, typename Enable = void>
+struct formatter {
+};
+
+// Non-owning view of count contiguous elements, printed like a container
+template<typename T>
+struct ArrayView {
+    const T *data_;
+    std::size_t size_;
+
+    const T *data() const { return data_; }
+    std::size_t size() const { return size_; }
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+};
+
+template<typename T>
+ArrayView<T> view(const T *data, std::size_t count)
+{
+    return ArrayView<T>{data, data == nullptr ? 0 : count};
+}
+
+template<>
+struct formatter<HexDump> {
+    static void format(std::string &out, const HexDump &v) { text::append_hexdump(out, v); }
+};
+
+namespace text
+{
+
+template<typename T, typename = void>
+struct has_formatter : std::false_type {};
+
+template<typename T>
+struct has_formatter<T, std::void_t<decltype(formatter<T>::format(std::declval<std::string &>(), std::declval<const T &>()))>>
+    : std::true_type {};
+
+template<typename T, typename = void>
+struct is_range : std::false_type {};
+
+template<typename T>
+struct is_range<T, std::void_t<decltype(std::begin(std::declval<const T &>())), decltype(std::end(std::declval<const T &>()))>>
+    : std::true_type {};
+
+template<typename T, typename = void>
+struct has_size : std::false_type {};
+
+template<typename T>
+struct has_size<T, std::void_t<decltype(std::size(std::declval<const T &>()))>> : std::true_type {};
+
+template<typename T, typename = void>
+struct is_contiguous : std::false_type {};
+
+template<typename T>
+struct is_contiguous<T, std::void_t<decltype(std::data(std::declval<const T &>())), decltype(std::size(std::declval<const T &>()))>>
+    : std::true_type {};
+
+template<typename T>
+struct is_pair : std::false_type {};
+
+template<typename A, typename B>
+struct is_pair<std::pair<A, B>> : std::true_type {};
+
+template<typename T>
+constexpr bool is_string_like_v = std::is_convertible_v<const T &, std::string_view> && !std::is_array_v<T>;
+
+template<typename T>
+void append(std::string &out, const T &v, std::size_t maxElements);
+
+inline void append_omitted(std::string &out, std::size_t omitted)
+{
+    out.append(out.back() == ' ' ? "... (+" : ", ... (+");
+    append_value(out, omitted);
+    out.append(" more)");
+}
+
+template<typename R>
+void append_range(std::string &out, const R &range, std::size_t maxElements)
+{
+    using It = decltype(std::begin(range));
+    using E = typename std::iterator_traits<It>::value_type;
+
+    if constexpr (is_contiguous<R>::value && std::is_arithmetic_v<E>) {
+        // Bulk path: sized once, written in place
+        const std::size_t size = std::size(range);
+        const std::size_t shown = size < maxElements ? size : maxElements;
+        if (shown == size) {
+            append_sequence(out, std::data(range), size);
+            return;
+        }
+        append_sequence(out, std::data(range), shown);
+        out.resize(out.size() - (shown ? 2 : 1));
+        append_omitted(out, size - shown);
+        out.append(" }");
+    } else {
+        It it = std::begin(range);
+        const auto last = std::end(range);
+        if (it == last) {
+            out.append("{ }");
+            return;
+        }
+        out.append("{ ");
+        std::size_t i = 0;
+        for (; it != last && i < maxElements; ++it, ++i) {
+            if (i) {
+                out.append(", ");
+                if (i % kElementsPerLine == 0) {
+                    out.push_back('\n');
+                }
+            }
+            const E &element = *it;
+            append(out, element, maxElements);
+        }
+        if (it != last) {
+            if constexpr (has_size<R>::value) {
+                append_omitted(out, std::size(range) - i);
+            } else {
+                out.append(", ...");
+            }
+        }
+        out.append(" }");
+    }
+}
+
+// Appends the text form of v to out without intermediate strings:
+// user formatters first, then numbers, strings, pairs ("key: value") and ranges.
+template<typename T>
+void append(std::string &out, const T &v, std::size_t maxElements)
+{
+    if constexpr (has_formatter<T>::value) {
+        formatter<T>::format(out, v);
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        append_value(out, v);
+    } else if constexpr (std::is_enum_v<T>) {
+        append_value(out, static_cast<std::underlying_type_t<T>>(v));
+    } else if constexpr (std::is_array_v<T> && std::is_same_v<std::remove_cv_t<std::remove_extent_t<T>>, char>) {
+        // Character arrays are strings, bounded by the array size
+        const std::size_t n = std::extent_v<T>;
+        const void *nul = std::memchr(v, '\0', n);
+        out.append(v, nul == nullptr ? n : static_cast<const char *>(nul) - v);
+    } else if constexpr (std::is_same_v<T, const char *> || std::is_same_v<T, char *>) {
+        out.append(v == nullptr ? "<null>" : v);
+    } else if constexpr (is_string_like_v<T>) {
+        out.append(std::string_view(v));
+    } else if constexpr (is_pair<T>::value) {
+        append(out, v.first, maxElements);
+        out.append(": ");
+        append(out, v.second, maxElements);
+    } else if constexpr (is_range<T>::value) {
+        append_range(out, v, maxElements);
+    } else if constexpr (std::is_pointer_v<T>) {
+        if (v == nullptr) {
+            out.append("<null>");
+        } else {
+            append_hex(out, reinterpret_cast<std::uintptr_t>(v));
+        }
+    } else {
+        static_assert(has_formatter<T>::value, "no tslogger::formatter<T> specialization for this type");
+    }
+}
+
+} // namespace text
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_FORMATTER_HPP
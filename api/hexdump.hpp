@@ -0,0 +1,63 @@
+#ifndef _TS_LOGGER_HEXDUMP_HPP
+#define _TS_LOGGER_HEXDUMP_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <type_traits>
+
+namespace tslogger
+{
+
+constexpr std::size_t kHexDumpBytesPerLine = 16;
+constexpr std::size_t kHexDumpDefaultMaxBytes = 1024;
+
+// Non-owning view of a byte buffer to be printed as a hexdump:
+//
+// 00000000  48 65 6c 6c 6f 2c 20 74  73 6c 6f 67 67 65 72 0a  |Hello, tslogger.|
+//
+// Only the first maxBytes bytes are printed, the rest is replaced by a
+// truncation marker.
+struct HexDump {
+    const std::uint8_t *data_;
+    std::size_t size_;
+    std::size_t maxBytes_;
+};
+
+inline HexDump hexdump(const void *data, std::size_t size, std::size_t maxBytes = kHexDumpDefaultMaxBytes)
+{
+    return HexDump{static_cast<const std::uint8_t *>(data), data == nullptr ? 0 : size, maxBytes};
+}
+
+// Any contiguous container: std::vector, std::array, std::string. Typed
+// pointers have no std::data() and take the overload above, so do C
+// arrays given a size: hexdump(buf, n) dumps n bytes.
+template<typename C, typename = std::enable_if_t<!std::is_array_v<C>>>
+auto hexdump(const C &c, std::size_t maxBytes = kHexDumpDefaultMaxBytes)
+    -> decltype(std::data(c), std::size(c), HexDump{})
+{
+    return hexdump(std::data(c), std::size(c) * sizeof(*std::data(c)), maxBytes);
+}
+
+// Whole C array
+template<typename T, std::size_t N>
+HexDump hexdump(const T (&array)[N])
+{
+    return hexdump(array, N * sizeof(T));
+}
+
+namespace text
+{
+
+// Appends the hexdump lines of the buffer; starts on a new line if out is not empty
+void append_hexdump(std::string &out, const HexDump &dump);
+
+// Name of the nibble-to-hex kernel selected for this CPU: "avx2", "sse2" or "scalar"
+const char *hexdump_kernel_name();
+
+} // namespace text
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_HEXDUMP_HPP
@@ -0,0 +1,24 @@
+#ifndef _TS_LOGGER_JSON_HPP
+#define _TS_LOGGER_JSON_HPP
+
+#include <string>
+#include <string_view>
+
+namespace tslogger::text
+{
+
+// Appends s as a quoted JSON string. '"', '\\' and control characters are
+// escaped, other bytes (including UTF-8 sequences) are copied as they are.
+// Runs without such bytes are found 16 bytes at a time with SSE2 and copied
+// in one piece.
+void append_json_string(std::string &out, std::string_view s);
+
+// Appends a JSON number, or null for NaN and infinities
+void append_json_number(std::string &out, double value);
+
+// Name of the escape scanning kernel: "sse2" or "scalar"
+const char *json_kernel_name();
+
+} // namespace tslogger::text
+
+#endif // _TS_LOGGER_JSON_HPP
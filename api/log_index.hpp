@@ -0,0 +1,90 @@
+#ifndef _TS_LOGGER_LOG_INDEX_HPP
+#define _TS_LOGGER_LOG_INDEX_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+namespace tslogger
+{
+
+// Sidecar index of a log file, "<log>.idx", written by the Handler when
+// Handler::index_block_bytes() is set. The log is cut into blocks of about
+// that many bytes at message boundaries, and every finished block appends
+// one entry: where it is, the time range of its messages and which levels
+// it holds. The bytes after the last entry are a block that is not
+// finished yet.
+//
+// The offsets are only valid while the log is written by this Handler
+// alone, and the index has to be removed with its log.
+struct LogIndexEntry {
+    std::uint64_t offset_;
+    std::uint64_t size_;
+    // Earliest and latest message timestamps, ns since the epoch. From
+    // version 2 on lastNs_ is raised to the lastNs_ of the entries before
+    // it, so the entries are sorted by it.
+    std::uint64_t firstNs_;
+    std::uint64_t lastNs_;
+    std::uint32_t lines_;
+    // Bit (1 << level) for each log_level_t present
+    std::uint32_t levels_;
+};
+
+constexpr char kLogIndexMagic[8] = {'T', 'S', 'L', 'I', 'D', 'X', '1', '\0'};
+// Written after the magic, with sizeof(LogIndexEntry)
+constexpr std::uint32_t kLogIndexVersion = 2;
+
+// Lines selected by LogIndexReader::query()
+struct LogQuery {
+    std::uint64_t fromNs_ = 0;
+    std::uint64_t toNs_ = UINT64_MAX;
+    // Bit (1 << level) for each wanted log_level_t
+    std::uint32_t levels_ = 0xf;
+};
+
+// Maps a log file and its index read-only and reads only the blocks that
+// can hold matching lines, so a query costs about the size of its result
+// plus a pass over the (small) index. In a version 2 index the first
+// block of a time query is found by binary search.
+//
+// Lines are matched by their "[LEVEL] date time" prefix or by the "level"
+// and "time_ns" members of JSON lines. A line without them, like the rest
+// of a multi-line message, takes the level and time of the line before it.
+class LogIndexReader {
+public:
+    LogIndexReader(const char *logPath, std::error_code &ec);
+    ~LogIndexReader();
+
+    LogIndexReader(const LogIndexReader &) = delete;
+    LogIndexReader &operator=(const LogIndexReader &) = delete;
+
+    // Calls fn with each matching line, without its line break, in file
+    // order; returns the number of lines passed to fn
+    std::size_t query(const LogQuery &query, const std::function<void(std::string_view line)> &fn) const;
+
+    std::size_t blocks() const { return m_entryCount_; }
+    // Bytes of the log read by the last query()
+    std::size_t scanned_bytes() const { return m_scanned_; }
+
+private:
+    std::size_t scan(std::size_t begin, std::size_t end, const LogQuery &query,
+        const std::function<void(std::string_view line)> &fn) const;
+
+private:
+    const char *m_log_;
+    std::size_t m_logSize_;
+    const void *m_index_;
+    std::size_t m_indexSize_;
+    const LogIndexEntry *m_entries_;
+    std::size_t m_entryCount_;
+    // Version 2 index, see LogIndexEntry::lastNs_
+    bool m_sorted_;
+    mutable std::size_t m_scanned_;
+};
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_LOG_INDEX_HPP
@@ -0,0 +1,68 @@
+#ifndef _TS_LOGGER_LOG_SHARD_HPP
+#define _TS_LOGGER_LOG_SHARD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace tslogger
+{
+
+// Per-thread shards of a log file, "<log>.<thread_id>.shard", written by
+// the Handler when Handler::thread_shards() is set. Every producer thread
+// has its own shard, so a shard is never interleaved with other threads.
+//
+// A shard is a sequence of records "<ns> <size> <line>": the message
+// timestamp in ns since the epoch and the size of the rendered line that
+// follows, so that the shards of a log can be merged back by time even
+// when a message spans several lines.
+void append_shard_record(std::string &out, std::uint64_t timestampNs, std::string_view line);
+
+// Path of the shard of log written by the thread with this id string,
+// see platform::thread_id_to_string()
+void append_shard_path(std::string &out, std::string_view log, std::string_view threadId);
+
+// Reads the records of a shard one at a time through a fixed buffer
+class LogShardReader {
+public:
+    LogShardReader(const char *path, std::error_code &ec);
+
+    LogShardReader(const LogShardReader &) = delete;
+    LogShardReader &operator=(const LogShardReader &) = delete;
+
+    // Reads the next record; false at the end of the shard or on error
+    bool next(std::error_code &ec);
+
+    std::uint64_t timestamp_ns() const { return m_timestampNs_; }
+    const std::string &line() const { return m_line_; }
+
+private:
+    static constexpr std::size_t kReadBuffer = 64 * 1024;
+
+    std::vector<char> m_buffer_;
+    std::ifstream m_in_;
+    std::uint64_t m_timestampNs_;
+    std::string m_line_;
+};
+
+// Merges the shards by timestamp with a k-way merge that holds one record
+// per shard, calling fn with every line in order. Records with the same
+// timestamp keep the order of paths, and the records of a shard always keep
+// their order. Returns the number of records passed to fn.
+//
+// A shard that cannot be opened or ends in a torn or corrupt record, as
+// after a crash, is left out from there on and the others are merged to
+// the end. ec then holds the first error and failed, if given, receives
+// the paths of those shards.
+std::size_t merge_log_shards(const std::vector<std::string> &paths,
+    const std::function<void(std::string_view line)> &fn, std::error_code &ec,
+    std::vector<std::string> *failed = nullptr);
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_LOG_SHARD_HPP
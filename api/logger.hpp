@@ -2,23 +2,49 @@
 #define _TS_LOGGER_HPP
 
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdarg>
 #include <cstdint>
 #include <cstring>
 #include <ctime>
+#include <deque>
+#include <functional>
 #include <ios>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include "call_site.hpp"
+#include "collector_sink.hpp"
+#include "fields.hpp"
+#include "formatter.hpp"
+#include "log_index.hpp"
+#include "log_shard.hpp"
 #include "logger_error.hpp"
+#include "metrics.hpp"
 #include "platform.hpp"
 #include "safe_queue.hpp"
+#include "shm_ring.hpp"
+#include "stats.hpp"
+
+// Messages of this level or more severe take the urgent lane of the handler
+// queue and are written before the backlog of the other files, still after
+// the older lines of their own file unless Handler::ordered_urgent(false)
+// lets them overtake those too. -1 sends every level through the normal lane.
+#ifndef TS_LOGGER_URGENT_LEVEL
+#define TS_LOGGER_URGENT_LEVEL ERROR
+#endif
 
 namespace tslogger
 {
@@ -69,17 +95,55 @@ inline bool is_flags_type(flags_t flags)
     return (flags >= FLAGS_OUTPUT_TO_NOWHERE && flags <= FLAGS_OUTPUT_TO_ALL);
 }
 
+// Layout of the lines written by the Handler
+enum output_format_t {
+    // "[LEVEL] date time thread_id: id message key=value ..."
+    OUTPUT_FORMAT_TEXT,
+    // One JSON object per line: level, time, thread_id, category, msg and
+    // the key-value fields of the message
+    OUTPUT_FORMAT_JSON,
+};
+
+// How a Logger writes the spans of LOG_SPAN, see span.hpp
+enum span_format_t {
+    // "span name depth=N duration_ns=N" line at the level of the span
+    SPAN_FORMAT_TEXT,
+    // One Chrome trace "complete" event per span, for chrome://tracing or
+    // Perfetto; the logger should write to a file of its own
+    SPAN_FORMAT_CHROME_TRACE,
+};
+
 struct Message {
     log_level_t logLevel_;
     std::string message_;
     std::thread::id threadId_;
     std::string filename_;
+    // Logger name used for per-category levels, the filename if empty
+    std::string category_;
     line_format_t format_;
     flags_t flags_;
     time_t timestamp_;
+    // Same moment as timestamp_, in nanoseconds since the epoch
+    std::uint64_t timestampNs_;
+    // Replayed from a flight recorder, written regardless of the max level
+    bool replayed_ = false;
+    // Logged by a CALL_SITE_ENABLED call site, written regardless of the max level
+    bool forced_ = false;
+    // Chrome trace event of a Span, see span.hpp; the first one written to
+    // a new file is preceded by the "[" that opens the event array
+    bool traceEvent_ = false;
+    // Key-value fields encoded by text::append_field(), see kv()
+    std::string fields_;
 };
 
 time_t timestamp();
+
+// std::this_thread::get_id() of the calling thread, read once per thread
+inline std::thread::id this_thread_id()
+{
+    thread_local const std::thread::id id = std::this_thread::get_id();
+    return id;
+}
 void timestamp_to_date_time_string(time_t ts, std::string &out);
 void add_timestamp_prefix(const char *filename, std::string &out);
 const char *log_level_to_string(log_level_t level);
@@ -92,6 +156,10 @@ std::string to_hex_string(T t)
     return stream.str();
 }
 
+class Handler;
+// Shards written by the producer threads themselves, see Handler::thread_shards()
+class ShardSink;
+
 class Logger {
 public:
     Logger(
@@ -101,10 +169,19 @@ public:
         line_format_t format = LINE_FORMAT_ALL)
         :
           m_queuePtr_{std::move(queuePtr)},
+          m_ringPtr_{},
+          m_shardsPtr_{},
           m_filename_{},
+          m_category_{},
           m_flags_{flags},
           m_format_{format},
-          m_defaultLevel_{DEBUG}
+          m_defaultLevel_{DEBUG},
+          m_maxElements_{TS_LOGGER_MAX_ELEMENTS},
+          m_recorder_{},
+          m_recorderNext_{0},
+          m_recorderCount_{0},
+          m_recorderLevel_{DEBUG},
+          m_spanFormat_{SPAN_FORMAT_TEXT}
     {
         if (filename == nullptr) {
             add_timestamp_prefix("_untitled.log", m_filename_);
@@ -119,6 +196,26 @@ public:
         }
     }
 
+    // Writes into a shared-memory ring, which a separate process drains
+    // (tools/tslogger_drain), instead of the handler queue
+    Logger(
+        std::shared_ptr<ShmRing> ringPtr,
+        const char *filename,
+        flags_t flags,
+        line_format_t format = LINE_FORMAT_ALL)
+        : Logger(std::shared_ptr<SafeQueue<Message>>(), filename, flags, format)
+    {
+        m_ringPtr_ = std::move(ringPtr);
+    }
+
+    // Writes into the handler queue, or in thread shard mode straight to
+    // the calling thread's shard, see Handler::thread_shards()
+    Logger(
+        Handler &handler,
+        const char *filename,
+        flags_t flags,
+        line_format_t format = LINE_FORMAT_ALL);
+
     ~Logger() = default;
 
     Logger(const Logger &) = delete;
@@ -126,112 +223,104 @@ public:
     Logger &operator=(const Logger &) = delete;
     Logger &operator=(Logger &&) = delete;
 
-    Logger &operator<<(const char *v);
-    Logger &operator<<(char *v);
-    Logger &operator<<(std::string &v);
-    Logger &operator<<(std::vector<char> &v);
-    Logger &operator<<(char &v);
+    // Collects all pieces of one << chain into a single message, which is
+    // pushed to the queue once, when the full expression ends:
+    //
+    // logger << "vector: " << v;            // one line, default level
+    // logger.at(ERROR) << "code " << code;  // one line, explicit level
+    class Statement {
+    public:
+        Statement(Logger &logger, log_level_t level)
+            : m_logger_{&logger}
+        {
+            logger.fill_message_common_parameters(level, m_msg_);
+        }
+
+        Statement(Statement &&other) noexcept
+            : m_logger_{other.m_logger_},
+              m_msg_{std::move(other.m_msg_)}
+        {
+            other.m_logger_ = nullptr;
+        }
+
+        ~Statement()
+        {
+            if (m_logger_ != nullptr && !(m_msg_.message_.empty() && m_msg_.fields_.empty())) {
+                m_logger_->push(std::move(m_msg_));
+            }
+        }
+
+        Statement(const Statement &) = delete;
+        Statement &operator=(const Statement &) = delete;
+        Statement &operator=(Statement &&) = delete;
+
+        template<typename T>
+        Statement &operator<<(const T &v)
+        {
+            text::append(m_msg_.message_, v, m_logger_->max_elements());
+            return *this;
+        }
+
+        template<typename T>
+        Statement &operator<<(const KeyValue<T> &field)
+        {
+            text::append_field(m_msg_.fields_, field.key_, field.value_, m_logger_->max_elements());
+            return *this;
+        }
+
+    private:
+        Logger *m_logger_;
+        Message m_msg_;
+    };
 
     void log(log_level_t level, const char *fmt, ...);
+    // Used by LOG: the message of a CALL_SITE_ENABLED site is forced_
+    void log(call_site_state_t site, log_level_t level, const char *fmt, ...);
 
     void fill_message_common_parameters(log_level_t level, Message &msg)
     {
-        msg.timestamp_ = timestamp();
+        const auto now = std::chrono::system_clock::now();
+        msg.timestamp_ = std::chrono::system_clock::to_time_t(now);
+        msg.timestampNs_ = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
         msg.logLevel_ = level;
-        msg.threadId_ = std::this_thread::get_id();
+        msg.threadId_ = this_thread_id();
         msg.filename_ = m_filename_;
+        msg.category_ = m_category_;
         msg.format_ = m_format_;
         msg.flags_ = m_flags_;
     }
 
+    // Formats any value supported by text::append(): numbers, strings,
+    // ranges (std::vector, std::map, ArrayView ...) and types with a
+    // tslogger::formatter<T> specialization
     template<typename T>
-    Logger &operator<<(T &v)
+    Statement operator<<(const T &v)
     {
-        Message msg;
-        fill_message_common_parameters(default_level(), msg);
-        msg.message_.append(std::to_string(v));
-        m_queuePtr_->push(msg);
-        return *this;
+        Statement st(*this, default_level());
+        st << v;
+        return st;
     }
 
-    template<typename T>
-    Logger &operator<<(std::vector<T> &v)
-    {
-        Message msg;
-        fill_message_common_parameters(default_level(), msg);
-        msg.message_.append("{ ");
-        if (v.empty()) {
-            msg.message_.append("}");
-            m_queuePtr_->push(msg);
-            return *this;
-        }
-        for (std::size_t i = 0; i < v.size(); ++i) {
-            if (i && i % 16 == 0) {
-                msg.message_.append("\n");
-}
-            msg.message_.append(std::to_string(v[i]));
-            msg.message_.append(i + 1 < v.size() ? ", " : " }");
-        }
-        m_queuePtr_->push(msg);
-        return *this;
-    }
+    Statement at(log_level_t level) { return Statement(*this, level); }
 
-    template<std::size_t N>
-    Logger &operator<<(std::array<char, N> &v)
+    void push(Message &&msg)
     {
-        Message msg;
-        fill_message_common_parameters(default_level(), msg);
-        msg.message_.append("{ ");
-        for (std::size_t i = 0; i < N; ++i) {
-            if (i && i % 16 == 0) {
-                msg.message_.append("\n");
-}
-            msg.message_.push_back(static_cast<char>(v[i]));
-            msg.message_.append(i + 1 < N ? ", " : " }");
+        if (!m_recorder_.empty() && record(msg)) {
+            return;
         }
-        m_queuePtr_->push(msg);
-        return *this;
+        send(std::move(msg));
     }
 
-    template<typename T, std::size_t N>
-    Logger &operator<<(std::array<T, N> &v)
-    {
-        Message msg;
-        fill_message_common_parameters(default_level(), msg);
-        msg.message_.append("{ ");
-        for (std::size_t i = 0; i < N; ++i) {
-            if (i && i % 16 == 0) {
-                msg.message_.append("\n");
-}
-            msg.message_.append(std::to_string(v[i]));
-            msg.message_.append(i + 1 < N ? ", " : " }");
-        }
-        m_queuePtr_->push(msg);
-        return *this;
-    }
+    // Flight recorder: keeps the last capacity messages less severe than
+    // threshold in memory instead of pushing them. They are pushed, oldest
+    // first, right before the next ERROR message or by
+    // flush_flight_recorder(), and the handler writes them whatever its
+    // max level is. A zero capacity turns the recorder off.
+    void flight_recorder(std::size_t capacity, log_level_t threshold);
 
-    template<typename T, std::size_t N>
-    Logger &operator<<(T (&v)[N])
-    {
-        Message msg;
-        fill_message_common_parameters(default_level(), msg);
-        msg.message_.append("{ ");
-        for (std::size_t i = 0; i < N; ++i) {
-            if (i && i % 16 == 0) {
-                msg.message_.append("\n");
-}
-            msg.message_.append(std::to_string(v[i]));
-            msg.message_.append(i + 1 < N ? ", " : " }");
-        }
-        m_queuePtr_->push(msg);
-        return *this;
-    }
+    void flush_flight_recorder();
 
-    template<typename T, std::size_t N>
-    Logger &operator<<(const T (&v)[N])
-    {
-        return operator<<(const_cast<T (&)[N]>(v));
-    }
+    std::size_t flight_recorder_size() const { return m_recorderCount_; }
 
     void filename(const char *filename)
     {
@@ -242,6 +331,11 @@ public:
 
     const char *filename() const { return m_filename_.c_str(); }
 
+    // Hierarchical name like "net.http.client", see Handler::category_level()
+    void category(const char *category) { m_category_ = category == nullptr ? "" : category; }
+
+    const char *category() const { return m_category_.c_str(); }
+
     flags_t flags() const { return m_flags_; }
 
     void flags(flags_t flags) { m_flags_ = flags; }
@@ -254,14 +348,78 @@ public:
 
     log_level_t default_level() const { return m_defaultLevel_; }
 
+    void max_elements(std::size_t count) { m_maxElements_ = count; }
+
+    void span_format(span_format_t format) { m_spanFormat_ = format; }
+
+    span_format_t span_format() const { return m_spanFormat_; }
+
+    std::size_t max_elements() const { return m_maxElements_; }
+
     std::shared_ptr<SafeQueue<Message>> queue_ptr() { return m_queuePtr_; }
 
+    std::shared_ptr<ShmRing> ring_ptr() { return m_ringPtr_; }
+
+private:
+    // Keeps msg in the flight recorder if it is less severe than the
+    // threshold, pushes the recorded messages before an ERROR
+    bool record(Message &msg);
+    void send(Message &&msg);
+    void vlog(log_level_t level, bool forced, const char *fmt, std::va_list args);
+
 private:
     std::shared_ptr<SafeQueue<Message>> m_queuePtr_;
+    std::shared_ptr<ShmRing> m_ringPtr_;
+    std::shared_ptr<ShardSink> m_shardsPtr_;
     std::string m_filename_;
+    std::string m_category_;
     flags_t m_flags_;
     line_format_t m_format_;
     log_level_t m_defaultLevel_;
+    std::size_t m_maxElements_;
+    std::vector<Message> m_recorder_;
+    // Slot of the next recorded message and number of recorded messages
+    std::size_t m_recorderNext_;
+    std::size_t m_recorderCount_;
+    log_level_t m_recorderLevel_;
+    span_format_t m_spanFormat_;
+};
+
+// Immutable handler configuration. A change creates a new snapshot, which
+// process() picks up through an atomic pointer without locking.
+struct HandlerConfig {
+    std::string root_;
+    log_level_t maxLevel_;
+    // Overrides of maxLevel_ by category prefix, the longest prefix wins
+    std::map<std::string, log_level_t, std::less<>> categoryLevels_;
+    // Identical consecutive messages of a sink within this window are
+    // collapsed into the first one and a "last message repeated N times" line,
+    // zero turns it off
+    std::chrono::nanoseconds dedupWindow_{0};
+    output_format_t outputFormat_ = OUTPUT_FORMAT_TEXT;
+    // If set, file lines are sent to this collector, which writes them
+    // under its own root directory, instead of being written under root_
+    std::shared_ptr<CollectorSink> collector_;
+    // If not zero, every log file gets a "<file>.idx" sidecar index with
+    // blocks of about this many bytes, see LogIndexReader
+    std::size_t indexBlockBytes_ = 0;
+    // Bumped by every Handler::index_block_bytes() call, the processing
+    // thread then closes the blocks being indexed
+    std::uint64_t indexGeneration_ = 0;
+    // Urgent messages are preceded by the older queued messages of their
+    // file, instead of overtaking them, see SafeQueue::pop_batch_ordered()
+    bool orderedUrgent_ = true;
+    // If not zero, file lines are collected in a buffer per file and
+    // written when it holds this many bytes, every fileFlushDelay_ and on
+    // Handler::flush()
+    std::size_t fileBufferBytes_ = 0;
+    std::chrono::nanoseconds fileFlushDelay_{0};
+    // Every thread writes its own shard of each file, see log_shard.hpp
+    bool threadShards_ = false;
+
+    // The category is split at '.' and '/': "net.http.client" is looked up
+    // as "net.http.client", "net.http" and "net" before falling back to maxLevel_
+    log_level_t level_for(std::string_view category) const;
 };
 
 class Handler {
@@ -276,6 +434,14 @@ public:
 
     std::shared_ptr<SafeQueue<Message>> get_queue_ptr() { return m_queuePtr_; }
 
+    // Maximum number of messages taken from the queue by one process() call
+    static constexpr std::size_t kBatchSize = 256;
+    // Maximum time process() waits for the queue to become ready
+    static constexpr std::chrono::seconds kMaxWait{1};
+
+    // Waits until the queue is ready (see SafeQueue::batch_threshold()) or
+    // kMaxWait passes, then writes out up to kBatchSize messages.
+    // With formatter threads, only one thread may call process().
     void process();
 
     void root(std::string root, std::error_code &ec);
@@ -290,24 +456,363 @@ public:
 
     log_level_t max_level() const;
 
+    // Sets the max logging level of a category and everything below it,
+    // e.g. "net" covers "net.http" and "net/client.log"
+    void category_level(const char *category, log_level_t level);
+
+    void clear_category_level(const char *category);
+
+    // Collapses identical consecutive messages (same level and body) written
+    // to the same file or to the stream within the window, a zero window
+    // turns it off
+    void dedup_window(std::chrono::milliseconds window);
+
+    std::chrono::milliseconds dedup_window() const;
+
+    // Text lines (the default) or JSON Lines
+    void output_format(output_format_t format);
+
+    output_format_t output_format() const;
+
+    // Sends the file lines to the tslogger_collector listening on the Unix
+    // domain socket instead of writing them; null or "" writes files again
+    void collector(const char *socketPath);
+
+    // Maintains a sidecar index for each log file written from now on, see
+    // LogIndexReader and tools/tslogger_query; zero turns it off
+    void index_block_bytes(std::size_t blockBytes);
+
+    std::size_t index_block_bytes() const;
+
+    // Messages up to TS_LOGGER_URGENT_LEVEL are written before the messages
+    // queued ahead of them. In ordered mode, the default, the older messages
+    // of the same file are written right before them, so every file keeps
+    // its order and only the backlog of the other files is overtaken; with
+    // false they overtake the whole backlog and are written ahead of older
+    // lines of their own file.
+    void ordered_urgent(bool ordered);
+
+    bool ordered_urgent() const;
+
+    // Collects the lines of each file in a buffer of the given size and
+    // writes it when it is full or, from a handler timer, at most maxDelay
+    // after its first line, or after every process() call if maxDelay is
+    // zero; zero bytes writes every line right away.
+    // Lines still buffered are lost if the process crashes.
+    void file_buffer(std::size_t bytes, std::chrono::milliseconds maxDelay);
+
+    std::size_t file_buffer_bytes() const;
+
+    // Writes out the buffered file lines
+    void flush();
+
+    // Writes the lines of each producer thread to its own shard of the
+    // file, "<file>.<thread_id>.shard", to be merged by time with
+    // tools/tslogger_merge.
+    //
+    // A Logger created from the Handler renders and writes its file lines
+    // on its own thread, into a shard it keeps open, without the queue or
+    // process(); lines for the stream still go through the queue. The
+    // shards use the file_buffer() size, and flush() and the flush timer
+    // write them out. Loggers created from the queue pointer have their
+    // lines written to the shards by process().
+    //
+    // The shards are not indexed and not deduplicated, and lines sent to a
+    // collector are not sharded.
+    void thread_shards(bool sharded);
+
+    bool thread_shards() const;
+
+    // Renders the lines on a pool of threads: every batch process() takes
+    // from the queue is formatted by one of them, while process() writes
+    // the batches rendered before it in queue order. Deduplication and the
+    // sinks stay on the process() thread, so the files keep their order.
+    // Zero stops the pool, after the batches in flight are rendered.
+    void formatter_threads(std::size_t count);
+
+    std::size_t formatter_threads() const;
+
+    HandlerConfig config() const;
+
+    // Sums the counters of all threads that have called process() or
+    // written their own shards
+    HandlerStats stats();
+
+    // Appends a stats() line to the file in the root directory every interval,
+    // a zero interval turns it off
+    void stats_to_file(const char *filename, std::chrono::milliseconds interval);
+
+    // Every interval, writes a WARNING line "file:line suppressed N messages"
+    // for each LOG_EVERY_N / LOG_FIRST_N / LOG_EVERY_MS / LOG_RATE_LIMITED
+    // call site that suppressed messages since the previous report.
+    // The sites are shared by all handlers, so only one should report.
+    // A zero interval turns it off.
+    void sampling_report(const char *filename, flags_t flags, std::chrono::milliseconds interval);
+
+    // Makes this handler the target of default_logger() and TSLOG. Each
+    // thread creates its Logger with these parameters on its next call,
+    // and drops it when another handler is made default or this one is
+    // destroyed.
+    void make_default(const char *filename, flags_t flags = FLAGS_OUTPUT_TO_FILE_ONLY,
+        line_format_t format = LINE_FORMAT_ALL);
+
+    // Every interval, writes an INFO line "metric name key=value ..." for
+    // each MetricCounter, MetricGauge and MetricHistogram updated since the
+    // previous report, see metrics.hpp. The metrics are shared by all
+    // handlers, so only one should report. A zero interval turns it off.
+    void metrics_report(const char *filename, flags_t flags, std::chrono::milliseconds interval);
+
+    // Every interval, reads the control file and, when its content has
+    // changed, replaces the call site rules with it, see
+    // apply_call_site_rules(). A missing or empty file resets all sites,
+    // a file with an invalid line is ignored. A zero interval turns it off.
+    void call_site_control(const char *path, std::chrono::milliseconds interval);
+
 private:
-    static void output_log(const Message &msg, std::ostream &out);
+    friend class Logger;
+    friend class ShardSink;
+
+    // Run of identical messages written to one sink
+    struct DedupRun {
+        std::uint64_t hash_ = 0;
+        // When the run started, steady clock ns
+        std::int64_t start_ = 0;
+        std::uint64_t repeats_ = 0;
+        // Header of the "repeated" line, copied on the first repeat
+        Message last_;
+    };
+
+    // State of a thread calling process()
+    struct ThreadState {
+        StatsCounters counters_;
+        std::unordered_map<std::string, DedupRun> fileRuns_;
+        DedupRun streamRun_;
+        // Frames for the collector sink, sent once per process() call
+        std::string collectorBatch_;
+        std::size_t collectorFrames_ = 0;
+        // Runs with repeats_ != 0
+        std::size_t pendingRuns_ = 0;
+        // Config epoch seen when the current process() call started,
+        // UINT64_MAX while the thread holds no config snapshot
+        std::atomic<std::uint64_t> configEpoch_{UINT64_MAX};
+    };
+
+    // Periodic work run by process() on the handler thread
+    using timer_fn_t = std::function<void(const HandlerConfig &config, ThreadState &state)>;
+
+    enum timer_id_t {
+        TIMER_STATS_FILE,
+        TIMER_SAMPLING_REPORT,
+        TIMER_CALL_SITE_CONTROL,
+        TIMER_FILE_FLUSH,
+        TIMER_METRICS_REPORT,
+    };
+
+    // Lines of a file not written yet
+    struct FileBuffer {
+        std::string data_;
+        std::size_t lines_ = 0;
+    };
+
+    // Block of a log file being indexed
+    struct FileIndex {
+        // End of the log file, where the next line goes
+        std::uint64_t end_;
+        // lastNs_ of the entries written so far, see LogIndexEntry::lastNs_
+        std::uint64_t lastNs_;
+        LogIndexEntry block_;
+    };
+
+    // Batch of messages rendered by a formatter thread
+    struct FormatJob {
+        std::vector<Message> messages_;
+        // Rendered line of each message, unused if it is filtered out
+        std::vector<std::string> lines_;
+        std::vector<char> filtered_;
+        bool claimed_ = false;
+        bool done_ = false;
+    };
+
+    struct Timer {
+        timer_id_t id_;
+        std::chrono::nanoseconds interval_;
+        std::int64_t next_;
+        timer_fn_t run_;
+    };
+
+    static void output_log(const Message &msg, output_format_t format, std::string &out);
+    static void output_text(const Message &msg, std::string &out);
+    static void output_json(const Message &msg, std::string &out);
+
+    ThreadState &this_thread_state();
+    static bool is_filtered(const HandlerConfig &config, const Message &msg);
+    void write_message(const HandlerConfig &config, const Message &msg, ThreadState &state);
+    // Writes msg past the level filter, rendering it unless rendered is given
+    void emit_message(const HandlerConfig &config, const Message &msg, const std::string *rendered,
+        ThreadState &state);
+    // Hands the batch over to the formatter threads, leaving it empty
+    void submit_job(std::vector<Message> &batch);
+    // Writes the finished jobs at the front of m_jobs_ in order, waiting
+    // for them until at most keep jobs are left in flight
+    void write_jobs(const HandlerConfig &config, ThreadState &state, std::size_t keep);
+    // First job not claimed by a formatter, m_poolMutex_ is held
+    FormatJob *claim_job();
+    static void format_job(const HandlerConfig &config, FormatJob &job, StatsCounters &counters);
+    void run_formatter();
+    bool write_to_file(const HandlerConfig &config, const Message &msg, const std::string &path,
+        const std::string &line, ThreadState &state);
+    // True for the first trace event written to path by this handler if
+    // the file is empty, see Message::traceEvent_
+    bool open_trace_file(const std::string &path);
+    // Appends line, or its buffer, to the file; a zero indexBlockBytes
+    // does not index it
+    bool write_file_data(const HandlerConfig &config, const Message &msg, const std::string &path,
+        const std::string &line, std::size_t indexBlockBytes, ThreadState &state);
+    // Adds a line appended to path to the block being indexed, buffered is
+    // the part of path (the line included) not written to the file yet;
+    // m_fileMutex_ is held
+    void index_line(const std::string &path, const Message &msg, std::size_t size, std::size_t buffered,
+        std::size_t blockBytes);
+    // Drops the block being indexed after a failed write, its bytes are
+    // covered by a gap entry when the file is indexed again; m_fileMutex_ is held
+    void drop_index(const std::string &path);
+    // Writes out the blocks being indexed and forgets the files, which
+    // start over from their size when indexed again; m_fileMutex_ is held
+    void close_index_blocks();
+    // m_fileMutex_ is held
+    bool flush_file_buffer(const std::string &path, FileBuffer &buffer, StatsCounters &counters);
+    // Also writes out the records buffered in the thread shards
+    void flush_file_buffers(StatsCounters &counters);
+    bool write_to_stream(const std::string &line, StatsCounters &counters);
+    // True if msg repeats the run within the window and must not be written.
+    // Otherwise the pending repeats are written out and a new run starts.
+    bool is_repeat(DedupRun &run, const std::string *path, const Message &msg, std::uint64_t hash,
+        std::int64_t now, const HandlerConfig &config, ThreadState &state);
+    void write_repeats(const HandlerConfig &config, DedupRun &run, const std::string *path, ThreadState &state);
+    // Writes out the runs older than the window, or all of them
+    void flush_repeats(const HandlerConfig &config, ThreadState &state, bool all);
+    // Adds or replaces a timer, a zero interval removes it
+    void schedule(timer_id_t id, std::chrono::nanoseconds interval, timer_fn_t run);
+    void run_timers(const HandlerConfig &config, ThreadState &state);
+    // Message written by a handler report, without its body
+    static void fill_report_message(log_level_t level, const std::string &filename, flags_t flags, Message &msg);
+    void write_sampling_report(const HandlerConfig &config, ThreadState &state,
+        const std::string &filename, flags_t flags);
+    void write_metrics_report(const HandlerConfig &config, ThreadState &state,
+        const std::string &filename, flags_t flags, double seconds);
+    template<typename F>
+    void update_config(F &&change);
+    void reclaim_configs();
 
 private:
-    std::string m_root_;
-    log_level_t m_maxLevel_;
     std::shared_ptr<SafeQueue<Message>> m_queuePtr_;
+    std::shared_ptr<ShardSink> m_shards_;
     std::ostream &m_stream_;
-    static bool s_init;
-    static std::mutex s_mutex;
+    const std::uint64_t m_id_;
+    mutable std::mutex m_configMutex_;
+    std::atomic<const HandlerConfig *> m_config_;
+    std::atomic<std::uint64_t> m_configEpoch_;
+    std::unique_ptr<HandlerConfig> m_configOwner_;
+    // Replaced snapshots with the epoch of their replacement, freed once
+    // every processing thread has moved past that epoch
+    std::vector<std::pair<std::uint64_t, std::unique_ptr<HandlerConfig>>> m_retiredConfigs_;
+    std::mutex m_statsMutex_;
+    std::vector<std::pair<std::thread::id, std::unique_ptr<ThreadState>>> m_threads_;
+    std::mutex m_timerMutex_;
+    std::vector<Timer> m_timers_;
+    // Guards the file buffers and indexes, so that lines reach a file in
+    // the order they are buffered and indexed
+    std::mutex m_fileMutex_;
+    std::unordered_map<std::string, FileIndex> m_indexes_;
+    // HandlerConfig::indexGeneration_ that m_indexes_ was built with,
+    // written with m_fileMutex_ held
+    std::atomic<std::uint64_t> m_indexGeneration_{0};
+    std::unordered_map<std::string, FileBuffer> m_fileBuffers_;
+    // Files that trace events were written to, see open_trace_file()
+    std::unordered_set<std::string> m_traceFiles_;
+    // Earliest next_ of m_timers_, INT64_MAX if there are none
+    std::atomic<std::int64_t> m_nextTimer_;
+    // Serializes formatter_threads() calls
+    mutable std::mutex m_formatterControlMutex_;
+    // Guards the formatter pool and its jobs
+    std::mutex m_poolMutex_;
+    std::condition_variable m_jobCv_;
+    std::condition_variable m_doneCv_;
+    std::vector<std::thread> m_formatters_;
+    bool m_stopFormatters_ = false;
+    // Jobs in queue order, only the process() thread adds and removes them
+    std::deque<std::unique_ptr<FormatJob>> m_jobs_;
+    std::vector<std::unique_ptr<FormatJob>> m_freeJobs_;
+    // Size of m_formatters_ and m_jobs_, read by process() without locking
+    std::atomic<std::size_t> m_formatterCount_{0};
+    std::atomic<std::size_t> m_jobCount_{0};
 };
 
+// Logger of the calling thread for the default handler, see
+// Handler::make_default(); null while there is none. The logger is created
+// on the first call of the thread, later calls cost a thread-local and an
+// atomic load. It may be configured like any Logger, e.g. its category.
+Logger *default_logger();
+
+// Each expansion owns a static CallSite, see set_call_sites(); a disabled
+// site does not format its arguments. The macros are statements, not the
+// expression obj.log(...): write if (cond) LOG(...); rather than using them
+// in a ?: or comma expression.
 #ifdef USE_TS_LOGGER
-#define LOG(obj, logLevel, ...) obj.log(logLevel, __VA_ARGS__)
+#define LOG(obj, logLevel, ...) \
+    do { \
+        static ::tslogger::CallSite tsLoggerCallSite_(__FILE__, __LINE__, __func__, logLevel); \
+        const ::tslogger::call_site_state_t tsLoggerState_ = tsLoggerCallSite_.state(); \
+        if (tsLoggerState_ != ::tslogger::CALL_SITE_DISABLED) { \
+            (obj).log(tsLoggerState_, logLevel, __VA_ARGS__); \
+        } \
+    } while (0)
 #else
 #define LOG(obj, logLevel, ...)
 #endif
 
+// LOG through default_logger(), no Logger to create or pass around
+#ifdef USE_TS_LOGGER
+#define TSLOG(logLevel, ...) \
+    do { \
+        static ::tslogger::CallSite tsLoggerCallSite_(__FILE__, __LINE__, __func__, logLevel); \
+        const ::tslogger::call_site_state_t tsLoggerState_ = tsLoggerCallSite_.state(); \
+        if (tsLoggerState_ != ::tslogger::CALL_SITE_DISABLED) { \
+            if (::tslogger::Logger *tsLogger_ = ::tslogger::default_logger()) { \
+                tsLogger_->log(tsLoggerState_, logLevel, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+#else
+#define TSLOG(logLevel, ...)
+#endif
+
+// Sampled variants of LOG. Each expansion owns a static CallSite and a
+// static SampledSite; a disabled call site is not counted by the sampling,
+// and the check runs before any argument is formatted.
+#ifdef USE_TS_LOGGER
+#define TS_LOGGER_SAMPLED_LOG(check, obj, logLevel, ...) \
+    do { \
+        static ::tslogger::CallSite tsLoggerCallSite_(__FILE__, __LINE__, __func__, logLevel); \
+        static ::tslogger::SampledSite tsLoggerSite_(__FILE__, __LINE__); \
+        const ::tslogger::call_site_state_t tsLoggerState_ = tsLoggerCallSite_.state(); \
+        if (tsLoggerState_ != ::tslogger::CALL_SITE_DISABLED && tsLoggerSite_.check) { \
+            (obj).log(tsLoggerState_, logLevel, __VA_ARGS__); \
+        } \
+    } while (0)
+#define LOG_EVERY_N(obj, logLevel, n, ...) TS_LOGGER_SAMPLED_LOG(every_n(n), obj, logLevel, __VA_ARGS__)
+#define LOG_FIRST_N(obj, logLevel, n, ...) TS_LOGGER_SAMPLED_LOG(first_n(n), obj, logLevel, __VA_ARGS__)
+#define LOG_EVERY_MS(obj, logLevel, ms, ...) TS_LOGGER_SAMPLED_LOG(every_ms(ms), obj, logLevel, __VA_ARGS__)
+#define LOG_RATE_LIMITED(obj, logLevel, perSecond, burst, ...) \
+    TS_LOGGER_SAMPLED_LOG(rate_limited(perSecond, burst), obj, logLevel, __VA_ARGS__)
+#else
+#define LOG_EVERY_N(obj, logLevel, n, ...)
+#define LOG_FIRST_N(obj, logLevel, n, ...)
+#define LOG_EVERY_MS(obj, logLevel, ms, ...)
+#define LOG_RATE_LIMITED(obj, logLevel, perSecond, burst, ...)
+#endif
+
+// Free-text markers without a duration, see LOG_SPAN in span.hpp
 #define ENTER_LOG(obj, logLevel) LOG(obj, logLevel, "%s:%d <<< Entering\n", __FILE__, __LINE__)
 #define EXIT_LOG(obj, logLevel) LOG(obj, logLevel, "%s:%d >>> Exiting\n", __FILE__, __LINE__)
 
@@ -5,8 +5,11 @@
 enum class TsLoggerStatus
 {
     TS_LOGGER_OK = 0,
+    // No longer returned, several handlers can coexist
     TS_LOGGER_ERR_SINGLE_INSTANCE,
     TS_LOGGER_ERR_NOT_DIRECTORY,
+    TS_LOGGER_ERR_BAD_RING,
+    TS_LOGGER_ERR_BAD_SHARD,
 };
 
 namespace std
@@ -0,0 +1,137 @@
+#ifndef _TS_LOGGER_METRICS_HPP
+#define _TS_LOGGER_METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "stats.hpp"
+
+namespace tslogger
+{
+
+// Metrics aggregate what would otherwise be one line per event, like
+// "processed request in X us". They are updated with relaxed atomics on a
+// stripe picked by the calling thread, and Handler::metrics_report()
+// writes one summary line per metric per interval.
+//
+// A metric is registered while it exists and is shared by all handlers,
+// so only one should report.
+
+// Cache-line sized stripes, a thread always updates the same one
+constexpr std::size_t kMetricStripes = 16;
+
+enum metric_type_t {
+    METRIC_COUNTER,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+inline std::size_t metric_stripe()
+{
+    static std::atomic<std::size_t> s_nextStripe{0};
+    thread_local const std::size_t stripe = s_nextStripe.fetch_add(1, std::memory_order_relaxed) % kMetricStripes;
+    return stripe;
+}
+
+class Metric {
+public:
+    Metric(const Metric &) = delete;
+    Metric &operator=(const Metric &) = delete;
+
+    const std::string &name() const { return m_name_; }
+
+    metric_type_t type() const { return m_type_; }
+
+    // Appends the key-value fields (see kv()) of the interval that ends and
+    // starts a new one; false if there is nothing to report
+    virtual bool take_summary(std::string &fields, double seconds) = 0;
+
+protected:
+    Metric(const char *name, metric_type_t type);
+    virtual ~Metric();
+
+private:
+    std::string m_name_;
+    metric_type_t m_type_;
+};
+
+// Number of events, reported with its rate
+class MetricCounter : public Metric {
+public:
+    explicit MetricCounter(const char *name) : Metric(name, METRIC_COUNTER) {}
+
+    void add(std::uint64_t n = 1)
+    {
+        m_stripes_[metric_stripe()].value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    bool take_summary(std::string &fields, double seconds) override;
+
+private:
+    struct alignas(64) Stripe {
+        std::atomic<std::uint64_t> value_{0};
+    };
+
+    std::array<Stripe, kMetricStripes> m_stripes_;
+};
+
+// Last value set, reported in the intervals it changed in. A gauge is a
+// single value, so it is not striped.
+class MetricGauge : public Metric {
+public:
+    explicit MetricGauge(const char *name) : Metric(name, METRIC_GAUGE) {}
+
+    void set(std::int64_t value)
+    {
+        m_value_.store(value, std::memory_order_relaxed);
+        m_changed_.store(true, std::memory_order_relaxed);
+    }
+
+    void add(std::int64_t delta)
+    {
+        m_value_.fetch_add(delta, std::memory_order_relaxed);
+        m_changed_.store(true, std::memory_order_relaxed);
+    }
+
+    std::int64_t value() const { return m_value_.load(std::memory_order_relaxed); }
+
+    bool take_summary(std::string &fields, double seconds) override;
+
+private:
+    std::atomic<std::int64_t> m_value_{0};
+    std::atomic<bool> m_changed_{false};
+};
+
+// Distribution of values, like durations, reported with count, min, max,
+// mean and percentiles. The percentiles have the power-of-two resolution
+// of Histogram.
+class MetricHistogram : public Metric {
+public:
+    explicit MetricHistogram(const char *name) : Metric(name, METRIC_HISTOGRAM) {}
+
+    void record(std::uint64_t value);
+
+    bool take_summary(std::string &fields, double seconds) override;
+
+private:
+    struct alignas(64) Stripe {
+        std::array<std::atomic<std::uint64_t>, kHistogramBuckets> buckets_{};
+        std::atomic<std::uint64_t> sum_{0};
+        std::atomic<std::uint64_t> min_{UINT64_MAX};
+        std::atomic<std::uint64_t> max_{0};
+    };
+
+    std::array<Stripe, kMetricStripes> m_stripes_;
+};
+
+// Calls fn with every registered metric, in registration order; metrics
+// are not created or destroyed meanwhile
+void for_each_metric(const std::function<void(Metric &metric)> &fn);
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_METRICS_HPP
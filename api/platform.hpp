@@ -1,6 +1,7 @@
 #ifndef _TS_LOGGER_PLATFORM_HPP
 #define _TS_LOGGER_PLATFORM_HPP
 
+#include <cstddef>
 #include <ctime>
 #include <string>
 #include <system_error>
@@ -11,9 +12,30 @@ namespace tslogger::platform
 
 bool create_directories(const std::string &path, std::error_code &ec);
 bool is_directory(const std::string &path, std::error_code &ec);
-bool append_to_file(const std::string &path, const std::string &text, std::error_code &ec);
+// writeCalls, if not null, is increased by the number of write() calls made
+bool append_to_file(const std::string &path, const std::string &text, std::error_code &ec, std::size_t *writeCalls = nullptr);
+// File kept open for appending: a descriptor, or -1 with ec set
+int open_append(const std::string &path, std::error_code &ec);
+// Writes all of text to fd, writeCalls as for append_to_file()
+bool write_all(int fd, const std::string &text, std::error_code &ec, std::size_t *writeCalls = nullptr);
+void close_file(int fd);
+// Maps the file shared and read-write, creating it and growing it to size
+// bytes if needed. A zero size maps the whole existing file. On success
+// size holds the mapped length.
+void *map_shared_file(const std::string &path, std::size_t &size, std::error_code &ec);
+// Maps the whole existing file read-only, size receives its length
+const void *map_file_readonly(const std::string &path, std::size_t &size, std::error_code &ec);
+void unmap_file(const void *addr, std::size_t size);
+bool file_size(const std::string &path, std::size_t &size, std::error_code &ec);
+// Non-blocking stream socket connected to a Unix domain socket path, -1 on failure
+int connect_unix_socket(const std::string &path, std::error_code &ec);
+// Sends what the socket takes without blocking: the number of bytes sent,
+// 0 if the socket buffer is full, -1 with ec set if the connection failed
+long send_nonblocking(int fd, const char *data, std::size_t size, std::error_code &ec);
+void close_socket(int fd);
 bool localtime_safe(std::time_t ts, std::tm &out);
 std::string thread_id_to_string(std::thread::id id);
+unsigned long process_id();
 
 } // namespace tslogger::platform
 
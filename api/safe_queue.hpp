@@ -4,9 +4,12 @@
 #include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <vector>
 
 #include "logger_error.hpp"
 
@@ -17,16 +20,61 @@ struct SafeQueue
     ~SafeQueue() = default;
 
     void push(T value);
+    // Urgent values go to a separate lane, which pop() and pop_batch() empty
+    // first, and wake up a waiting consumer regardless of batch_threshold()
+    void push(T value, bool urgent);
 
     std::optional<T> pop();
     std::optional<T> front();
     bool empty();
     size_t size();
+    size_t peak_size();
+    // Moves up to maxCount values into out, urgent ones first, returns the
+    // number moved
+    size_t pop_batch(std::vector<T> &out, size_t maxCount);
+    // Like pop_batch(), but each urgent value is preceded by the values
+    // pushed before it for which sameGroup(value, urgentValue) is true, so
+    // the order within a group is kept. When they do not fit into maxCount,
+    // the urgent value stays queued and the next call continues with them.
+    template<typename SameGroup>
+    size_t pop_batch_ordered(std::vector<T> &out, size_t maxCount, SameGroup sameGroup);
+    // A waiting consumer is woken up when the queue holds this many values
+    // (1 by default, i.e. on the empty to non-empty transition) or on timeout
+    void batch_threshold(size_t count);
     void wait_wail_empty();
     void wait_wail_empty_for(size_t seconds);
+    template<typename Rep, typename Period>
+    void wait_wail_empty_for(const std::chrono::duration<Rep, Period> &timeout);
 
 private:
-    std::queue<T> m_queue_;
+    // Sequence numbers order the values of both lanes
+    struct Entry {
+        uint64_t seq_;
+        T value_;
+    };
+
+    bool ready() const { return !m_urgent_.empty() || (!m_queue_.empty() && m_queue_.size() >= m_threshold_); }
+    void notify_if_ready(std::unique_lock<std::mutex> &ul);
+    // Wait predicate. A waiter that wakes up to a queue another consumer
+    // has drained goes back to sleep, and the next push() must signal again.
+    bool ready_or_rearm()
+    {
+        if (ready()) {
+            return true;
+        }
+        m_signaled_ = false;
+        return false;
+    }
+
+    std::deque<Entry> m_queue_;
+    std::deque<Entry> m_urgent_;
+    uint64_t m_nextSeq_ = 0;
+    size_t m_peak_ = 0;
+    size_t m_threshold_ = 1;
+    // Consumers parked in wait_wail_empty*(); push() signals only when one is
+    // parked and the queue has just become ready, not on every value
+    size_t m_waiters_ = 0;
+    bool m_signaled_ = false;
     std::mutex m_mutex_;
     std::condition_variable m_cv_;
 };
@@ -42,11 +90,33 @@ struct SafeQueue<T *>
     T *front();
     bool empty();
     size_t size();
+    size_t peak_size();
+    size_t pop_batch(std::vector<T *> &out, size_t maxCount);
+    void batch_threshold(size_t count);
     void wait_wail_empty();
     void wait_wail_empty_for(size_t seconds);
+    template<typename Rep, typename Period>
+    void wait_wail_empty_for(const std::chrono::duration<Rep, Period> &timeout);
 
 private:
+    bool ready() const { return !m_queue_.empty() && m_queue_.size() >= m_threshold_; }
+    void notify_if_ready(std::unique_lock<std::mutex> &ul);
+    // Wait predicate. A waiter that wakes up to a queue another consumer
+    // has drained goes back to sleep, and the next push() must signal again.
+    bool ready_or_rearm()
+    {
+        if (ready()) {
+            return true;
+        }
+        m_signaled_ = false;
+        return false;
+    }
+
     std::queue<T *> m_queue_;
+    size_t m_peak_ = 0;
+    size_t m_threshold_ = 1;
+    size_t m_waiters_ = 0;
+    bool m_signaled_ = false;
     std::mutex m_mutex_;
     std::condition_variable m_cv_;
 };
@@ -60,8 +130,10 @@ void SafeQueue<T *>::push(T *value, std::error_code &ec)
     }
     std::unique_lock<std::mutex> ul(m_mutex_);
     m_queue_.push(value);
-    ul.unlock();
-    m_cv_.notify_one();
+    if (m_queue_.size() > m_peak_) {
+        m_peak_ = m_queue_.size();
+    }
+    notify_if_ready(ul);
 }
 
 template<typename T>
@@ -104,33 +176,96 @@ size_t SafeQueue<T *>::size()
     return m_queue_.size();
 }
 
+template<typename T>
+size_t SafeQueue<T *>::peak_size()
+{
+    std::lock_guard<std::mutex> lg(m_mutex_);
+    return m_peak_;
+}
+
+template<typename T>
+void SafeQueue<T *>::notify_if_ready(std::unique_lock<std::mutex> &ul)
+{
+    const bool wake = m_waiters_ != 0 && !m_signaled_ && ready();
+    if (wake) {
+        m_signaled_ = true;
+    }
+    ul.unlock();
+    if (wake) {
+        m_cv_.notify_one();
+    }
+}
+
+template<typename T>
+size_t SafeQueue<T *>::pop_batch(std::vector<T *> &out, size_t maxCount)
+{
+    std::lock_guard<std::mutex> lg(m_mutex_);
+    size_t count = 0;
+    while (count < maxCount && !m_queue_.empty()) {
+        out.push_back(std::move(m_queue_.front()));
+        m_queue_.pop();
+        ++count;
+    }
+    return count;
+}
+
+template<typename T>
+void SafeQueue<T *>::batch_threshold(size_t count)
+{
+    std::unique_lock<std::mutex> ul(m_mutex_);
+    m_threshold_ = count;
+    notify_if_ready(ul);
+}
+
 template<typename T>
 void SafeQueue<T *>::wait_wail_empty()
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
-    if (!m_queue_.empty()) {
+    if (ready()) {
         return;
-}
-    m_cv_.wait(ul, [this] { return !m_queue_.empty(); });
+    }
+    ++m_waiters_;
+    m_cv_.wait(ul, [this] { return ready_or_rearm(); });
+    --m_waiters_;
+    m_signaled_ = false;
 }
 
 template<typename T>
 void SafeQueue<T *>::wait_wail_empty_for(size_t seconds)
+{
+    wait_wail_empty_for(std::chrono::seconds(seconds));
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+void SafeQueue<T *>::wait_wail_empty_for(const std::chrono::duration<Rep, Period> &timeout)
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
-    if (!m_queue_.empty()) {
+    if (ready()) {
         return;
-}
-    m_cv_.wait_for(ul, std::chrono::seconds(seconds), [this] { return !m_queue_.empty(); });
+    }
+    ++m_waiters_;
+    m_cv_.wait_for(ul, timeout, [this] { return ready_or_rearm(); });
+    --m_waiters_;
+    m_signaled_ = false;
 }
 
 template<typename T>
 void SafeQueue<T>::push(T value)
+{
+    push(std::move(value), false);
+}
+
+template<typename T>
+void SafeQueue<T>::push(T value, bool urgent)
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
-    m_queue_.push(std::move(value));
-    ul.unlock();
-    m_cv_.notify_one();
+    (urgent ? m_urgent_ : m_queue_).push_back(Entry{m_nextSeq_++, std::move(value)});
+    const size_t size = m_queue_.size() + m_urgent_.size();
+    if (size > m_peak_) {
+        m_peak_ = size;
+    }
+    notify_if_ready(ul);
 }
 
 template<typename T>
@@ -138,12 +273,13 @@ std::optional<T> SafeQueue<T>::pop()
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
 
-    if (m_queue_.empty()) {
+    std::deque<Entry> &lane = m_urgent_.empty() ? m_queue_ : m_urgent_;
+    if (lane.empty()) {
         return std::nullopt;
     }
 
-    T value = std::move(m_queue_.front());
-    m_queue_.pop();
+    T value = std::move(lane.front().value_);
+    lane.pop_front();
     return value;
 }
 
@@ -152,45 +288,146 @@ std::optional<T> SafeQueue<T>::front()
 {
     std::lock_guard<std::mutex> lg(m_mutex_);
 
-    if (m_queue_.empty()) {
+    const std::deque<Entry> &lane = m_urgent_.empty() ? m_queue_ : m_urgent_;
+    if (lane.empty()) {
         return std::nullopt;
     }
 
-    return m_queue_.front();
+    return lane.front().value_;
 }
 
 template<typename T>
 bool SafeQueue<T>::empty()
 {
     std::lock_guard<std::mutex> lg(m_mutex_);
-    return m_queue_.empty();
+    return m_queue_.empty() && m_urgent_.empty();
 }
 
 template<typename T>
 size_t SafeQueue<T>::size()
 {
     std::lock_guard<std::mutex> lg(m_mutex_);
-    return m_queue_.size();
+    return m_queue_.size() + m_urgent_.size();
+}
+
+template<typename T>
+size_t SafeQueue<T>::peak_size()
+{
+    std::lock_guard<std::mutex> lg(m_mutex_);
+    return m_peak_;
+}
+
+template<typename T>
+void SafeQueue<T>::notify_if_ready(std::unique_lock<std::mutex> &ul)
+{
+    const bool wake = m_waiters_ != 0 && !m_signaled_ && ready();
+    if (wake) {
+        m_signaled_ = true;
+    }
+    ul.unlock();
+    if (wake) {
+        m_cv_.notify_one();
+    }
+}
+
+template<typename T>
+size_t SafeQueue<T>::pop_batch(std::vector<T> &out, size_t maxCount)
+{
+    std::lock_guard<std::mutex> lg(m_mutex_);
+    size_t count = 0;
+    for (std::deque<Entry> *lane : {&m_urgent_, &m_queue_}) {
+        while (count < maxCount && !lane->empty()) {
+            out.push_back(std::move(lane->front().value_));
+            lane->pop_front();
+            ++count;
+        }
+    }
+    return count;
+}
+
+template<typename T>
+template<typename SameGroup>
+size_t SafeQueue<T>::pop_batch_ordered(std::vector<T> &out, size_t maxCount, SameGroup sameGroup)
+{
+    std::lock_guard<std::mutex> lg(m_mutex_);
+    size_t count = 0;
+    while (count < maxCount && !m_urgent_.empty()) {
+        Entry &urgent = m_urgent_.front();
+        // The normal lane is in sequence order, so the older values are a
+        // prefix of it; the values of other groups are compacted in place
+        auto kept = m_queue_.begin();
+        auto it = m_queue_.begin();
+        bool complete = true;
+        for (; it != m_queue_.end() && it->seq_ < urgent.seq_; ++it) {
+            if (sameGroup(static_cast<const T &>(it->value_), static_cast<const T &>(urgent.value_))) {
+                if (count == maxCount) {
+                    complete = false;
+                    break;
+                }
+                out.push_back(std::move(it->value_));
+                ++count;
+            } else {
+                if (kept != it) {
+                    *kept = std::move(*it);
+                }
+                ++kept;
+            }
+        }
+        m_queue_.erase(kept, it);
+        if (!complete || count == maxCount) {
+            return count;
+        }
+        out.push_back(std::move(urgent.value_));
+        m_urgent_.pop_front();
+        ++count;
+    }
+    while (count < maxCount && !m_queue_.empty()) {
+        out.push_back(std::move(m_queue_.front().value_));
+        m_queue_.pop_front();
+        ++count;
+    }
+    return count;
+}
+
+template<typename T>
+void SafeQueue<T>::batch_threshold(size_t count)
+{
+    std::unique_lock<std::mutex> ul(m_mutex_);
+    m_threshold_ = count;
+    notify_if_ready(ul);
 }
 
 template<typename T>
 void SafeQueue<T>::wait_wail_empty()
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
-    if (!m_queue_.empty()) {
+    if (ready()) {
         return;
-}
-    m_cv_.wait(ul, [this] { return !m_queue_.empty(); });
+    }
+    ++m_waiters_;
+    m_cv_.wait(ul, [this] { return ready_or_rearm(); });
+    --m_waiters_;
+    m_signaled_ = false;
 }
 
 template<typename T>
 void SafeQueue<T>::wait_wail_empty_for(size_t seconds)
+{
+    wait_wail_empty_for(std::chrono::seconds(seconds));
+}
+
+template<typename T>
+template<typename Rep, typename Period>
+void SafeQueue<T>::wait_wail_empty_for(const std::chrono::duration<Rep, Period> &timeout)
 {
     std::unique_lock<std::mutex> ul(m_mutex_);
-    if (!m_queue_.empty()) {
+    if (ready()) {
         return;
-}
-    m_cv_.wait_for(ul, std::chrono::seconds(seconds), [this] { return !m_queue_.empty(); });
+    }
+    ++m_waiters_;
+    m_cv_.wait_for(ul, timeout, [this] { return ready_or_rearm(); });
+    --m_waiters_;
+    m_signaled_ = false;
 }
 
 #endif
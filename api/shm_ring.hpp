@@ -0,0 +1,77 @@
+#ifndef _TS_LOGGER_SHM_RING_HPP
+#define _TS_LOGGER_SHM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <system_error>
+
+namespace tslogger
+{
+
+struct Message;
+struct ShmRingHeader;
+
+// Multi-producer, single-consumer ring of messages in a memory-mapped file.
+//
+// Loggers in the application push() into the ring with a CAS on the head and
+// plain stores into the mapping, so logging makes no system calls. A drain
+// process (tools/tslogger_drain) pop()s the records and hands them to a
+// Handler. The ring lives in the file, so records committed before an
+// application crash are still drained afterwards.
+//
+// Each record starts with an atomic word holding its length and state:
+// reserved by a producer, committed, or padding up to the end of the data
+// area, so a record never wraps.
+class ShmRing {
+public:
+    // Opens the ring file, creating it with capacity bytes of data area if it
+    // does not exist. The capacity is rounded up to a power of two, zero
+    // opens an existing ring with its own capacity.
+    ShmRing(const char *path, std::size_t capacity, std::error_code &ec);
+    ~ShmRing();
+
+    ShmRing(const ShmRing &) = delete;
+    ShmRing(ShmRing &&) = delete;
+    ShmRing &operator=(const ShmRing &) = delete;
+    ShmRing &operator=(ShmRing &&) = delete;
+
+    // Copies the message into the ring, false if it is full
+    bool push(const Message &msg);
+
+    // Takes the oldest committed record, false if there is none. Only one
+    // thread in one process may pop.
+    bool pop(Message &msg);
+
+    // Skips the oldest record if a producer reserved it but never committed
+    // it, e.g. because the application crashed while writing it. A producer
+    // that dies after moving the head but before storing the record word
+    // leaves zeroed space, which is skipped up to the next stored record.
+    // Call it only after the ring has stalled for a while: a producer that
+    // is merely slow loses its record.
+    bool skip_reserved();
+
+    std::size_t capacity() const { return m_capacity_; }
+    // Bytes reserved and not popped yet
+    std::size_t pending() const;
+    // Messages not pushed because the ring was full, across all processes
+    std::uint64_t dropped() const;
+
+private:
+    std::atomic<std::uint64_t> &word_at(std::uint64_t position) const;
+    // Clears the record at the tail, so that stale bytes are never taken
+    // for a record word, and releases it to the producers
+    void release(std::uint64_t tail, std::uint64_t length);
+
+private:
+    void *m_addr_;
+    std::size_t m_size_;
+    ShmRingHeader *m_header_;
+    unsigned char *m_data_;
+    std::size_t m_capacity_;
+};
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_SHM_RING_HPP
@@ -0,0 +1,58 @@
+#ifndef _TS_LOGGER_SPAN_HPP
+#define _TS_LOGGER_SPAN_HPP
+
+#include <cstdint>
+
+#include "call_site.hpp"
+#include "logger.hpp"
+
+namespace tslogger
+{
+
+// Times a scope and logs it when the scope ends, in the span_format() of
+// the logger: a "span name depth=N duration_ns=N" line, or a Chrome trace
+// event. The depth counts the spans open on the thread around this one,
+// across loggers. A disabled call site reads no clock.
+//
+// {
+//     LOG_SPAN(logger, INFO, "parse_request");
+//     ...
+// }
+class Span {
+public:
+    // name must outlive the span, like a string literal
+    Span(Logger &logger, call_site_state_t site, log_level_t level, const char *name);
+    ~Span();
+
+    Span(const Span &) = delete;
+    Span &operator=(const Span &) = delete;
+
+private:
+    Logger *m_logger_;
+    const char *m_name_;
+    log_level_t m_level_;
+    bool m_forced_;
+    std::uint32_t m_depth_;
+    // System clock start for trace timestamps, steady clock start for the duration
+    std::uint64_t m_startNs_;
+    std::int64_t m_steadyStart_;
+};
+
+} // namespace tslogger
+
+#define TS_LOGGER_SPAN_CONCAT2(a, b) a##b
+#define TS_LOGGER_SPAN_CONCAT(a, b) TS_LOGGER_SPAN_CONCAT2(a, b)
+
+// Declares a Span over the rest of the enclosing scope, with a call site
+// like LOG. TS_LOGGER_NO_SPANS strips the spans alone at compile time.
+#if defined(USE_TS_LOGGER) && !defined(TS_LOGGER_NO_SPANS)
+#define LOG_SPAN(obj, logLevel, name) \
+    static ::tslogger::CallSite TS_LOGGER_SPAN_CONCAT(tsLoggerSpanSite_, __LINE__)( \
+        __FILE__, __LINE__, __func__, logLevel); \
+    const ::tslogger::Span TS_LOGGER_SPAN_CONCAT(tsLoggerSpan_, __LINE__)( \
+        obj, TS_LOGGER_SPAN_CONCAT(tsLoggerSpanSite_, __LINE__).state(), logLevel, name)
+#else
+#define LOG_SPAN(obj, logLevel, name) static_cast<void>(0)
+#endif
+
+#endif // _TS_LOGGER_SPAN_HPP
@@ -0,0 +1,97 @@
+#ifndef _TS_LOGGER_STATS_HPP
+#define _TS_LOGGER_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace tslogger
+{
+
+// Bucket i counts values in [2^i, 2^(i+1)), the last bucket everything above
+constexpr std::size_t kHistogramBuckets = 40;
+
+struct Histogram {
+    std::array<std::uint64_t, kHistogramBuckets> buckets_{};
+    std::uint64_t count_ = 0;
+    std::uint64_t sum_ = 0;
+    std::uint64_t min_ = 0;
+    std::uint64_t max_ = 0;
+
+    // Upper bound of the bucket holding the p-th percentile (0..100)
+    std::uint64_t percentile(double p) const;
+};
+
+std::size_t histogram_bucket(std::uint64_t value);
+
+struct SinkStats {
+    std::uint64_t messages_ = 0;
+    std::uint64_t bytes_ = 0;
+    std::uint64_t writeCalls_ = 0;
+    std::uint64_t writeNs_ = 0;
+    std::uint64_t errors_ = 0;
+};
+
+// Snapshot returned by Handler::stats()
+struct HandlerStats {
+    std::size_t queueDepth_ = 0;
+    std::size_t peakQueueDepth_ = 0;
+    std::uint64_t processed_ = 0;
+    // Messages above the max logging level or with FLAGS_OUTPUT_TO_NOWHERE
+    std::uint64_t filtered_ = 0;
+    // Messages lost because a sink failed to write them
+    std::uint64_t dropped_ = 0;
+    // Messages collapsed by the dedup window on all their sinks
+    std::uint64_t deduplicated_ = 0;
+    // From the message timestamp to the end of its last sink write, in ns
+    Histogram latencyNs_;
+    SinkStats file_;
+    SinkStats stream_;
+    // Frames queued for the collector; errors_ are frames dropped because
+    // the pending data was full or the connection was lost mid-frame
+    SinkStats collector_;
+};
+
+// Appends the snapshot as a single "key=value ..." line
+void append_stats(std::string &out, const HandlerStats &stats);
+
+// Counters of a single thread calling Handler::process(). Only the owner
+// thread writes them, so updates are plain relaxed load/store pairs, and
+// Handler::stats() sums all blocks when it is called.
+struct StatsCounters {
+    using counter_t = std::atomic<std::uint64_t>;
+
+    struct Sink {
+        counter_t messages_{0};
+        counter_t bytes_{0};
+        counter_t writeCalls_{0};
+        counter_t writeNs_{0};
+        counter_t errors_{0};
+    };
+
+    counter_t processed_{0};
+    counter_t filtered_{0};
+    counter_t dropped_{0};
+    counter_t deduplicated_{0};
+    std::array<counter_t, kHistogramBuckets> latency_{};
+    counter_t latencySum_{0};
+    counter_t latencyMin_{UINT64_MAX};
+    counter_t latencyMax_{0};
+    Sink file_;
+    Sink stream_;
+    Sink collector_;
+
+    static void add(counter_t &c, std::uint64_t value)
+    {
+        c.store(c.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    void add_latency(std::uint64_t ns);
+    void add_to(HandlerStats &stats) const;
+};
+
+} // namespace tslogger
+
+#endif // _TS_LOGGER_STATS_HPP
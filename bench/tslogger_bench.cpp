@@ -0,0 +1,511 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <new>
+#include <streambuf>
+
+using namespace tslogger;
+using bench_clock = std::chrono::steady_clock;
+
+// Every heap allocation made by the process is counted, which gives the
+// bytes allocated per logged message
+static std::atomic<std::size_t> g_allocBytes{0};
+static std::atomic<std::size_t> g_allocCount{0};
+
+static void *counted_alloc(std::size_t size) noexcept
+{
+    g_allocBytes.fetch_add(size, std::memory_order_relaxed);
+    g_allocCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+// Kept out of line: once free() is inlined into a delete-expression GCC
+// pairs it with the new-expression and reports -Wmismatched-new-delete
+__attribute__((noinline)) static void release_alloc(void *p) noexcept { std::free(p); }
+
+// The full replaceable set is provided so every new is paired with a
+// matching delete
+void *operator new(std::size_t size)
+{
+    if (void *p = counted_alloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    if (void *p = counted_alloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return counted_alloc(size); }
+
+void operator delete(void *p) noexcept { release_alloc(p); }
+void operator delete[](void *p) noexcept { release_alloc(p); }
+void operator delete(void *p, std::size_t) noexcept { release_alloc(p); }
+void operator delete[](void *p, std::size_t) noexcept { release_alloc(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { release_alloc(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { release_alloc(p); }
+
+namespace
+{
+
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+NullBuffer g_nullBuffer;
+std::ostream g_nullStream(&g_nullBuffer);
+
+struct Options {
+    std::string root = "/tmp/tslogger_bench";
+    std::string output;
+    std::size_t messages = 200000;
+};
+
+// Small JSON writer: objects and arrays of numbers and strings
+class Json {
+public:
+    void begin_object(const char *key = nullptr) { open(key, '{'); }
+    void end_object() { close('}'); }
+    void begin_array(const char *key = nullptr) { open(key, '['); }
+    void end_array() { close(']'); }
+
+    // JSON has no NaN or infinity, they are written as null
+    void value(const char *key, double v)
+    {
+        name(key);
+        if (std::isfinite(v)) {
+            text::append_value(m_out_, v);
+        } else {
+            m_out_.append("null");
+        }
+    }
+
+    void value(const char *key, const char *v)
+    {
+        name(key);
+        m_out_.push_back('"');
+        m_out_.append(v);
+        m_out_.push_back('"');
+    }
+
+    const std::string &str() const { return m_out_; }
+
+private:
+    void name(const char *key)
+    {
+        if (!m_first_) {
+            m_out_.push_back(',');
+        }
+        m_first_ = false;
+        m_out_.append("\n");
+        m_out_.append(m_depth_ * 2, ' ');
+        if (key != nullptr) {
+            m_out_.append("\"").append(key).append("\": ");
+        }
+    }
+
+    void open(const char *key, char c)
+    {
+        name(key);
+        m_out_.push_back(c);
+        m_first_ = true;
+        ++m_depth_;
+    }
+
+    void close(char c)
+    {
+        --m_depth_;
+        m_out_.append("\n");
+        m_out_.append(m_depth_ * 2, ' ');
+        m_out_.push_back(c);
+        m_first_ = false;
+    }
+
+    std::string m_out_;
+    bool m_first_ = true;
+    int m_depth_ = 0;
+};
+
+// Runs Handler::process() on a separate thread until stopped
+class Drainer {
+public:
+    explicit Drainer(Handler &handler)
+        : m_running_{true},
+          m_thread_{[this, &handler]() {
+              while (m_running_.load(std::memory_order_relaxed)) {
+                  handler.process();
+              }
+              while (!handler.get_queue_ptr()->empty()) {
+                  handler.process();
+              }
+          }}
+    {
+    }
+
+    ~Drainer()
+    {
+        m_running_ = false;
+        m_thread_.join();
+    }
+
+private:
+    std::atomic<bool> m_running_;
+    std::thread m_thread_;
+};
+
+double percentile(std::vector<std::int64_t> &samples, double p)
+{
+    if (samples.empty()) {
+        return 0;
+    }
+    const std::size_t idx = std::min(samples.size() - 1, static_cast<std::size_t>(p / 100.0 * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+    return static_cast<double>(samples[idx]);
+}
+
+template<typename F>
+void latency_case(Json &json, const char *name, std::size_t count, F &&call)
+{
+    std::vector<std::int64_t> samples(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        const auto t0 = bench_clock::now();
+        call(i);
+        const auto t1 = bench_clock::now();
+        samples[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count();
+    }
+    json.begin_object();
+    json.value("name", name);
+    json.value("calls", static_cast<double>(count));
+    json.value("p50_ns", percentile(samples, 50));
+    json.value("p99_ns", percentile(samples, 99));
+    json.value("p999_ns", percentile(samples, 99.9));
+    json.value("max_ns", static_cast<double>(*std::max_element(samples.begin(), samples.end())));
+    json.end_object();
+}
+
+void bench_latency(Json &json, Handler &handler, const Options &opt)
+{
+    Drainer drainer(handler);
+    Logger logger(handler.get_queue_ptr(), "bench_latency.log", FLAGS_OUTPUT_TO_NOWHERE, LINE_FORMAT_ALL);
+    std::vector<int> v(16, 12345);
+
+    json.begin_array("producer_latency");
+    latency_case(json, "log", opt.messages, [&](std::size_t i) {
+        logger.log(INFO, "request %d finished in %f ms: %s\n", static_cast<int>(i), 1.25, "ok");
+    });
+    latency_case(json, "operator<<", opt.messages, [&](std::size_t i) {
+        logger << "request " << i << " finished in " << 1.25 << " ms: ok\n";
+    });
+    latency_case(json, "operator<< vector<int>[16]", opt.messages, [&](std::size_t) {
+        logger << "samples: " << v << "\n";
+    });
+    json.end_array();
+}
+
+void bench_throughput(Json &json, Handler &handler, const Options &opt)
+{
+    json.begin_array("producer_throughput");
+    for (unsigned threads : {1u, 2u, 4u, 8u}) {
+        Drainer drainer(handler);
+        const std::size_t perThread = std::max<std::size_t>(1, opt.messages / threads);
+        std::atomic<unsigned> ready{0};
+        std::atomic<bool> go{false};
+        std::vector<std::thread> producers;
+
+        for (unsigned t = 0; t < threads; ++t) {
+            producers.emplace_back([&]() {
+                Logger logger(handler.get_queue_ptr(), "bench_throughput.log", FLAGS_OUTPUT_TO_NOWHERE, LINE_FORMAT_ALL);
+                ++ready;
+                while (!go.load()) {
+                    std::this_thread::yield();
+                }
+                for (std::size_t i = 0; i < perThread; ++i) {
+                    logger.log(INFO, "message %u from a producer thread\n", static_cast<unsigned>(i));
+                }
+            });
+        }
+        while (ready.load() != threads) {
+            std::this_thread::yield();
+        }
+        const auto t0 = bench_clock::now();
+        go = true;
+        for (std::thread &th : producers) {
+            th.join();
+        }
+        const double seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+        json.begin_object();
+        json.value("threads", threads);
+        json.value("messages", static_cast<double>(perThread * threads));
+        json.value("msgs_per_sec", perThread * threads / seconds);
+        json.end_object();
+    }
+    json.end_array();
+}
+
+void bench_drain(Json &json, Handler &handler, const Options &opt)
+{
+    struct Sink {
+        const char *name;
+        flags_t flags;
+        std::size_t messages;
+    };
+    // Every file message opens, appends and closes the file, so fewer are used
+    const Sink sinks[] = {
+        {"discard", FLAGS_OUTPUT_TO_NOWHERE, opt.messages},
+        {"stream", FLAGS_OUTPUT_TO_STREAM_ONLY, opt.messages},
+        {"file", FLAGS_OUTPUT_TO_FILE_ONLY, std::max<std::size_t>(1, opt.messages / 10)},
+    };
+
+    json.begin_array("handler_drain");
+    for (const Sink &sink : sinks) {
+        Logger logger(handler.get_queue_ptr(), "bench_drain.log", sink.flags, LINE_FORMAT_ALL);
+        for (std::size_t i = 0; i < sink.messages; ++i) {
+            logger.log(INFO, "message %u queued before the drain\n", static_cast<unsigned>(i));
+        }
+        const auto t0 = bench_clock::now();
+        while (!handler.get_queue_ptr()->empty()) {
+            handler.process();
+        }
+        const double seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+        json.begin_object();
+        json.value("sink", sink.name);
+        json.value("messages", static_cast<double>(sink.messages));
+        json.value("msgs_per_sec", sink.messages / seconds);
+        json.end_object();
+    }
+    json.end_array();
+}
+
+void bench_shards(Json &json, Handler &handler, const Options &opt)
+{
+    struct Case {
+        const char *writer;
+        bool direct;
+        std::size_t bufferBytes;
+    };
+    // The handler thread opens, appends and closes the shard for every
+    // unbuffered line, so fewer messages are used
+    const Case cases[] = {
+        {"handler_thread", false, 0},
+        {"producer_threads", true, 0},
+        {"handler_thread", false, 64 * 1024},
+        {"producer_threads", true, 64 * 1024},
+    };
+    const std::size_t messages = std::max<std::size_t>(1, opt.messages / 10);
+
+    handler.thread_shards(true);
+    json.begin_array("thread_shards");
+    for (const Case &c : cases) {
+        handler.file_buffer(c.bufferBytes, std::chrono::milliseconds(100));
+        for (unsigned threads : {1u, 4u}) {
+            const std::size_t perThread = std::max<std::size_t>(1, messages / threads);
+            std::atomic<unsigned> ready{0};
+            std::atomic<bool> go{false};
+            std::vector<std::thread> producers;
+            std::unique_ptr<Drainer> drainer;
+            if (!c.direct) {
+                drainer = std::make_unique<Drainer>(handler);
+            }
+
+            for (unsigned t = 0; t < threads; ++t) {
+                producers.emplace_back([&]() {
+                    Logger logger = c.direct
+                        ? Logger(handler, "bench_shards.log", FLAGS_OUTPUT_TO_FILE_ONLY, LINE_FORMAT_ALL)
+                        : Logger(handler.get_queue_ptr(), "bench_shards.log", FLAGS_OUTPUT_TO_FILE_ONLY, LINE_FORMAT_ALL);
+                    ++ready;
+                    while (!go.load()) {
+                        std::this_thread::yield();
+                    }
+                    for (std::size_t i = 0; i < perThread; ++i) {
+                        logger.log(INFO, "message %u written to the thread shard\n", static_cast<unsigned>(i));
+                    }
+                });
+            }
+            while (ready.load() != threads) {
+                std::this_thread::yield();
+            }
+            // Timed until every line is in its shard file
+            const auto t0 = bench_clock::now();
+            go = true;
+            for (std::thread &th : producers) {
+                th.join();
+            }
+            drainer.reset();
+            handler.flush();
+            const double seconds = std::chrono::duration<double>(bench_clock::now() - t0).count();
+
+            json.begin_object();
+            json.value("writer", c.writer);
+            json.value("file_buffer_bytes", static_cast<double>(c.bufferBytes));
+            json.value("threads", threads);
+            json.value("messages", static_cast<double>(perThread * threads));
+            json.value("msgs_per_sec", perThread * threads / seconds);
+            json.end_object();
+        }
+    }
+    json.end_array();
+    handler.file_buffer(0, std::chrono::milliseconds(0));
+    handler.thread_shards(false);
+}
+
+void bench_allocations(Json &json, Handler &handler, const Options &opt)
+{
+    Logger logger(handler.get_queue_ptr(), "bench_alloc.log", FLAGS_OUTPUT_TO_NOWHERE, LINE_FORMAT_ALL);
+    std::vector<int> v(16, 12345);
+    const std::size_t count = std::max<std::size_t>(1, opt.messages / 10);
+
+    json.begin_array("allocations");
+    auto measure = [&](const char *name, auto &&call) {
+        const std::size_t bytes0 = g_allocBytes.load();
+        const std::size_t count0 = g_allocCount.load();
+        for (std::size_t i = 0; i < count; ++i) {
+            call(i);
+        }
+        json.begin_object();
+        json.value("name", name);
+        json.value("bytes_per_msg", static_cast<double>(g_allocBytes.load() - bytes0) / count);
+        json.value("allocs_per_msg", static_cast<double>(g_allocCount.load() - count0) / count);
+        json.end_object();
+        while (!handler.get_queue_ptr()->empty()) {
+            handler.process();
+        }
+    };
+    measure("log", [&](std::size_t i) {
+        logger.log(INFO, "request %d finished in %f ms: %s\n", static_cast<int>(i), 1.25, "ok");
+    });
+    measure("operator<<", [&](std::size_t i) {
+        logger << "request " << i << " finished in " << 1.25 << " ms: ok\n";
+    });
+    measure("operator<< vector<int>[16]", [&](std::size_t) {
+        logger << "samples: " << v << "\n";
+    });
+    json.end_array();
+}
+
+// The container formatting used before the to_chars kernels
+template<typename T>
+void append_sequence_to_string(std::string &out, const std::vector<T> &v)
+{
+    out.append("{ ");
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (i && i % 16 == 0) {
+            out.append("\n");
+        }
+        out.append(std::to_string(v[i]));
+        out.append(i + 1 < v.size() ? ", " : " }");
+    }
+}
+
+template<typename T>
+void format_case(Json &json, const char *name, const std::vector<T> &v)
+{
+    constexpr int kRounds = 200;
+    std::string out;
+    auto run = [&](auto &&fn) {
+        const auto t0 = bench_clock::now();
+        for (int r = 0; r < kRounds; ++r) {
+            out.clear();
+            out.shrink_to_fit();
+            fn();
+        }
+        return std::chrono::duration<double, std::nano>(bench_clock::now() - t0).count() / (kRounds * v.size());
+    };
+    const double legacy = run([&]() { append_sequence_to_string(out, v); });
+    const double kernel = run([&]() { text::append(out, v, v.size()); });
+
+    json.begin_object();
+    json.value("name", name);
+    json.value("elements", static_cast<double>(v.size()));
+    json.value("to_string_ns_per_elem", legacy);
+    json.value("to_chars_ns_per_elem", kernel);
+    json.end_object();
+}
+
+void bench_formatting(Json &json)
+{
+    std::vector<int> ints(4096);
+    std::vector<double> doubles(4096);
+    for (std::size_t i = 0; i < ints.size(); ++i) {
+        ints[i] = static_cast<int>(i * 2654435761u);
+        doubles[i] = static_cast<double>(ints[i]) / 1000.0;
+    }
+    json.begin_array("container_formatting");
+    format_case(json, "vector<int>", ints);
+    format_case(json, "vector<double>", doubles);
+    json.end_array();
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-o" || arg == "--output")) {
+            opt.output = argv[++i];
+        } else if (i + 1 < argc && (arg == "-r" || arg == "--root")) {
+            opt.root = argv[++i];
+        } else if (i + 1 < argc && (arg == "-n" || arg == "--messages")) {
+            opt.messages = std::strtoul(argv[++i], nullptr, 10);
+        } else {
+            return false;
+        }
+    }
+    return opt.messages > 0;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0] << " [-o result.json] [-r root_dir] [-n messages]\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    Handler handler(opt.root.c_str(), DEBUG, g_nullStream, ec);
+    if (ec.value()) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+
+    Json json;
+    json.begin_object();
+    json.value("benchmark", "tslogger");
+    json.value("messages", static_cast<double>(opt.messages));
+    json.value("hexdump_kernel", text::hexdump_kernel_name());
+    bench_latency(json, handler, opt);
+    bench_throughput(json, handler, opt);
+    bench_drain(json, handler, opt);
+    bench_shards(json, handler, opt);
+    bench_allocations(json, handler, opt);
+    bench_formatting(json);
+    json.end_object();
+
+    if (opt.output.empty()) {
+        std::cout << json.str() << "\n";
+    } else {
+        std::ofstream file(opt.output);
+        file << json.str() << "\n";
+        if (!file) {
+            std::cerr << "Unable to write " << opt.output << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
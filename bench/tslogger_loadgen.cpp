@@ -0,0 +1,672 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <streambuf>
+
+using namespace tslogger;
+using load_clock = std::chrono::steady_clock;
+
+// Replays a logging workload against a Handler and reports whether the
+// Handler keeps up with it: throughput, queue depth and latency, every
+// interval and for the whole run.
+//
+// The workload profile is a mix of message classes (level and size) with
+// weights, a number of files the messages are spread over and optionally
+// a timeline of messages per second, whose shape is replayed in a loop to
+// reproduce bursts. It is generated from the options or extracted from a
+// log file written by a Handler (-l), and can be saved (-o) and loaded
+// again (-p):
+//
+// # tslogger_loadgen profile
+// files 4
+// message INFO 96 5321
+// message ERROR 240 12
+// timeline 120 80 4000 95
+
+namespace
+{
+
+// A queue left at the stop that takes longer than this to write out
+// counts as falling behind
+constexpr double kMaxDrainSeconds = 0.1;
+
+struct NullBuffer : std::streambuf {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override { return n; }
+};
+
+NullBuffer g_nullBuffer;
+std::ostream g_nullStream(&g_nullBuffer);
+
+struct MessageClass {
+    log_level_t level;
+    std::size_t bytes;
+    std::uint64_t weight;
+};
+
+struct Profile {
+    std::vector<MessageClass> classes;
+    unsigned files = 1;
+    // Messages per second, scaled to the requested rate
+    std::vector<std::uint64_t> timeline;
+};
+
+struct Options {
+    std::string profile;
+    std::string fromLog;
+    std::string saveProfile;
+    std::string root = "/tmp/tslogger_loadgen";
+    std::string sink = "file";
+    std::string collector;
+    unsigned threads = 4;
+    unsigned writers = 1;
+    // Messages per second over all threads, 0 as fast as possible
+    double rate = 100000;
+    double seconds = 10;
+    unsigned files = 0;
+    log_level_t maxLevel = DEBUG;
+    bool json = false;
+    std::chrono::milliseconds interval{1000};
+    std::chrono::milliseconds dedupWindow{0};
+    std::size_t indexBlockBytes = 0;
+};
+
+bool parse_level(const std::string &name, log_level_t &level)
+{
+    for (log_level_t l : {ERROR, WARNING, INFO, DEBUG}) {
+        if (name == log_level_to_string(l)) {
+            level = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Roughly what a service writes: mostly short INFO/DEBUG lines, few and
+// longer WARNING/ERROR ones
+Profile synthetic_profile()
+{
+    Profile profile;
+    profile.classes = {
+        {DEBUG, 64, 250}, {DEBUG, 160, 100},
+        {INFO, 48, 250}, {INFO, 120, 250}, {INFO, 400, 60},
+        {WARNING, 160, 50}, {WARNING, 1024, 10},
+        {ERROR, 240, 20}, {ERROR, 4096, 10},
+    };
+    profile.files = 4;
+    return profile;
+}
+
+bool load_profile(const std::string &path, Profile &profile)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string key;
+        if (!(fields >> key) || key[0] == '#') {
+            continue;
+        }
+        if (key == "files") {
+            fields >> profile.files;
+        } else if (key == "message") {
+            std::string level;
+            MessageClass c{};
+            if (!(fields >> level >> c.bytes >> c.weight) || !parse_level(level, c.level)) {
+                return false;
+            }
+            profile.classes.push_back(c);
+        } else if (key == "timeline") {
+            std::uint64_t count = 0;
+            while (fields >> count) {
+                profile.timeline.push_back(count);
+            }
+        } else {
+            return false;
+        }
+    }
+    return !profile.classes.empty() && profile.files != 0;
+}
+
+bool save_profile(const std::string &path, const Profile &profile)
+{
+    std::ofstream out(path);
+    out << "# tslogger_loadgen profile\n";
+    out << "files " << profile.files << "\n";
+    for (const MessageClass &c : profile.classes) {
+        out << "message " << log_level_to_string(c.level) << " " << c.bytes << " " << c.weight << "\n";
+    }
+    for (std::size_t i = 0; i < profile.timeline.size(); i += 16) {
+        out << "timeline";
+        for (std::size_t j = i; j < std::min(i + 16, profile.timeline.size()); ++j) {
+            out << " " << profile.timeline[j];
+        }
+        out << "\n";
+    }
+    return static_cast<bool>(out);
+}
+
+// Seconds of a "YYYY-MM-DD HH:MM:SS" local time, 0 if s is not one
+std::uint64_t parse_date_time(const char *s)
+{
+    std::tm tm = {};
+    if (std::sscanf(s, "%4d-%2d-%2d %2d:%2d:%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+            &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    const std::time_t t = std::mktime(&tm);
+    return t < 0 ? 0 : static_cast<std::uint64_t>(t);
+}
+
+// Size class of a message: 16 byte steps up to 256, then 4 steps per
+// power of two
+std::size_t size_class(std::size_t bytes)
+{
+    if (bytes <= 256) {
+        return (bytes + 15) / 16;
+    }
+    const std::size_t log2 = histogram_bucket(bytes);
+    return 16 + log2 * 4 + ((bytes >> (log2 - 2)) & 3);
+}
+
+// Builds the profile from the messages of a text or JSON Lines log file.
+// A line starting with "[LEVEL]" or {"level":"LEVEL" starts a message, any
+// other line continues the one before it.
+bool extract_profile(const std::string &path, unsigned files, Profile &profile)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return false;
+    }
+
+    struct Class {
+        std::uint64_t count = 0;
+        std::uint64_t bytes = 0;
+    };
+    std::map<std::pair<int, std::size_t>, Class> classes;
+    std::map<std::uint64_t, std::uint64_t> perSecond;
+    std::string cachedTime;
+    std::uint64_t cachedSeconds = 0;
+
+    bool open = false;
+    log_level_t level = INFO;
+    std::size_t bytes = 0;
+    auto finish = [&]() {
+        if (open) {
+            Class &c = classes[{level, size_class(bytes)}];
+            ++c.count;
+            c.bytes += bytes;
+        }
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        log_level_t lineLevel = INFO;
+        std::uint64_t seconds = 0;
+        bool header = false;
+        if (line.size() > 2 && line[0] == '[') {
+            const std::size_t close = line.find(']');
+            header = close != std::string::npos && parse_level(line.substr(1, close - 1), lineLevel);
+            if (header && line.size() >= close + 21) {
+                const std::string time = line.substr(close + 2, 19);
+                if (time != cachedTime) {
+                    cachedTime = time;
+                    cachedSeconds = parse_date_time(time.c_str());
+                }
+                seconds = cachedSeconds;
+            }
+        } else if (line.compare(0, 10, "{\"level\":\"") == 0) {
+            const std::size_t end = line.find('"', 10);
+            header = end != std::string::npos && parse_level(line.substr(10, end - 10), lineLevel);
+            const std::size_t at = line.find("\"time_ns\":");
+            if (header && at != std::string::npos) {
+                seconds = std::strtoull(line.c_str() + at + 10, nullptr, 10) / 1000000000;
+            }
+        }
+
+        if (header) {
+            finish();
+            open = true;
+            level = lineLevel;
+            bytes = 0;
+            if (seconds != 0) {
+                ++perSecond[seconds];
+            }
+        }
+        bytes += line.size() + 1;
+    }
+    finish();
+
+    for (const auto &entry : classes) {
+        const std::uint64_t mean = entry.second.bytes / entry.second.count;
+        profile.classes.push_back({static_cast<log_level_t>(entry.first.first), mean, entry.second.count});
+    }
+    // Seconds without messages are part of the burst pattern too
+    if (!perSecond.empty()) {
+        const std::uint64_t first = perSecond.begin()->first;
+        const std::uint64_t last = perSecond.rbegin()->first;
+        if (last - first < 24 * 3600) {
+            profile.timeline.assign(last - first + 1, 0);
+            for (const auto &entry : perSecond) {
+                profile.timeline[entry.first - first] = entry.second;
+            }
+        }
+    }
+    profile.files = files == 0 ? 1 : files;
+    return !profile.classes.empty();
+}
+
+// Weighted choice of a message class, one table lookup per message
+class ClassPicker {
+public:
+    explicit ClassPicker(const std::vector<MessageClass> &classes)
+    {
+        std::uint64_t total = 0;
+        for (const MessageClass &c : classes) {
+            total += c.weight;
+        }
+        std::uint64_t sum = 0;
+        std::size_t next = 0;
+        m_table_.resize(kTableSize);
+        for (std::size_t i = 0; i < classes.size(); ++i) {
+            sum += classes[i].weight;
+            const std::size_t end = total == 0 ? kTableSize : static_cast<std::size_t>(sum * kTableSize / total);
+            for (; next < end; ++next) {
+                m_table_[next] = static_cast<std::uint32_t>(i);
+            }
+        }
+        for (; next < kTableSize; ++next) {
+            m_table_[next] = static_cast<std::uint32_t>(classes.size() - 1);
+        }
+    }
+
+    std::size_t pick(std::uint64_t random) const { return m_table_[random & (kTableSize - 1)]; }
+
+private:
+    static constexpr std::size_t kTableSize = 4096;
+    std::vector<std::uint32_t> m_table_;
+};
+
+std::uint64_t xorshift(std::uint64_t &state)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Messages a producer should have sent after elapsed seconds: the timeline
+// (or a flat one) is looped and scaled so that its mean is rate
+class Schedule {
+public:
+    Schedule(const std::vector<std::uint64_t> &timeline, double rate)
+        : m_rate_{rate}
+    {
+        if (timeline.empty()) {
+            return;
+        }
+        double sum = 0;
+        for (std::uint64_t count : timeline) {
+            sum += static_cast<double>(count);
+        }
+        if (sum == 0) {
+            return;
+        }
+        const double scale = rate * static_cast<double>(timeline.size()) / sum;
+        m_cumulative_.push_back(0);
+        for (std::uint64_t count : timeline) {
+            m_cumulative_.push_back(m_cumulative_.back() + static_cast<double>(count) * scale);
+        }
+    }
+
+    double due(double elapsed) const
+    {
+        if (m_cumulative_.empty()) {
+            return elapsed * m_rate_;
+        }
+        const std::size_t seconds = m_cumulative_.size() - 1;
+        const double loops = std::floor(elapsed / static_cast<double>(seconds));
+        const double rest = elapsed - loops * static_cast<double>(seconds);
+        const std::size_t second = std::min(seconds - 1, static_cast<std::size_t>(rest));
+        const double within = m_cumulative_[second + 1] - m_cumulative_[second];
+        return loops * m_cumulative_.back() + m_cumulative_[second] + within * (rest - static_cast<double>(second));
+    }
+
+private:
+    const double m_rate_;
+    std::vector<double> m_cumulative_;
+};
+
+// Producer side call latency, one histogram per producer thread
+struct ProducerStats {
+    std::array<std::atomic<std::uint64_t>, kHistogramBuckets> buckets{};
+    std::atomic<std::uint64_t> max{0};
+    std::atomic<std::uint64_t> sent{0};
+};
+
+Histogram to_histogram(const std::vector<std::unique_ptr<ProducerStats>> &producers, std::uint64_t &sent)
+{
+    Histogram h;
+    sent = 0;
+    for (const auto &p : producers) {
+        for (std::size_t i = 0; i < kHistogramBuckets; ++i) {
+            const std::uint64_t n = p->buckets[i].load(std::memory_order_relaxed);
+            h.buckets_[i] += n;
+            h.count_ += n;
+        }
+        h.max_ = std::max(h.max_, p->max.load(std::memory_order_relaxed));
+        sent += p->sent.load(std::memory_order_relaxed);
+    }
+    return h;
+}
+
+// Latency of the messages written between two snapshots
+Histogram interval_histogram(const Histogram &now, const Histogram &before)
+{
+    Histogram h;
+    for (std::size_t i = 0; i < kHistogramBuckets; ++i) {
+        h.buckets_[i] = now.buckets_[i] - before.buckets_[i];
+        h.count_ += h.buckets_[i];
+    }
+    h.max_ = now.max_;
+    return h;
+}
+
+void producer(Handler &handler, const Profile &profile, const Options &opt, unsigned index,
+    const std::atomic<bool> &stop, load_clock::time_point start, ProducerStats &stats)
+{
+    const unsigned files = opt.files != 0 ? opt.files : profile.files;
+    const flags_t flags = opt.sink == "stream" ? FLAGS_OUTPUT_TO_STREAM_ONLY
+        : opt.sink == "none" ? FLAGS_OUTPUT_TO_NOWHERE : FLAGS_OUTPUT_TO_FILE_ONLY;
+    std::vector<std::unique_ptr<Logger>> loggers;
+    for (unsigned f = 0; f < files; ++f) {
+        const std::string filename = "loadgen_" + std::to_string(f) + ".log";
+        loggers.push_back(std::make_unique<Logger>(handler.get_queue_ptr(), filename.c_str(), flags, LINE_FORMAT_ALL));
+    }
+
+    // A body per class, the rendered message is about the class size
+    std::vector<std::string> bodies;
+    for (const MessageClass &c : profile.classes) {
+        std::string body;
+        const std::size_t prefix = 48;
+        for (std::size_t i = 0; body.size() + prefix < c.bytes; ++i) {
+            body.push_back(static_cast<char>('a' + i % 26));
+            if (i % 80 == 79) {
+                body.push_back('\n');
+            }
+        }
+        bodies.push_back(std::move(body));
+    }
+
+    const ClassPicker picker(profile.classes);
+    const Schedule schedule(profile.timeline, opt.rate / opt.threads);
+    std::uint64_t random = 0x9e3779b97f4a7c15ull * (index + 1);
+    std::uint64_t sent = 0;
+
+    while (!stop.load(std::memory_order_relaxed)) {
+        if (opt.rate > 0) {
+            const double elapsed = std::chrono::duration<double>(load_clock::now() - start).count();
+            if (static_cast<double>(sent) >= schedule.due(elapsed)) {
+                // Open loop: a late producer catches up instead of slowing
+                // down, so the queue grows when the Handler falls behind
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+                continue;
+            }
+        }
+        const std::uint64_t r = xorshift(random);
+        const std::size_t c = picker.pick(r);
+        Logger &logger = *loggers[(r >> 12) % files];
+
+        const auto t0 = load_clock::now();
+        logger.log(profile.classes[c].level, "loadgen t%u #%u %s\n", index,
+            static_cast<unsigned>(sent), bodies[c].c_str());
+        const auto ns = static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(load_clock::now() - t0).count());
+
+        auto &bucket = stats.buckets[histogram_bucket(ns)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (ns > stats.max.load(std::memory_order_relaxed)) {
+            stats.max.store(ns, std::memory_order_relaxed);
+        }
+        stats.sent.store(++sent, std::memory_order_relaxed);
+    }
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-p" || arg == "--profile")) {
+            opt.profile = argv[++i];
+        } else if (i + 1 < argc && (arg == "-l" || arg == "--from-log")) {
+            opt.fromLog = argv[++i];
+        } else if (i + 1 < argc && (arg == "-o" || arg == "--save-profile")) {
+            opt.saveProfile = argv[++i];
+        } else if (i + 1 < argc && (arg == "-r" || arg == "--root")) {
+            opt.root = argv[++i];
+        } else if (i + 1 < argc && (arg == "-s" || arg == "--sink")) {
+            opt.sink = argv[++i];
+            if (opt.sink != "file" && opt.sink != "stream" && opt.sink != "none") {
+                return false;
+            }
+        } else if (i + 1 < argc && (arg == "-c" || arg == "--collector")) {
+            opt.collector = argv[++i];
+        } else if (i + 1 < argc && (arg == "-t" || arg == "--threads")) {
+            opt.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && (arg == "-w" || arg == "--writers")) {
+            opt.writers = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && (arg == "-R" || arg == "--rate")) {
+            opt.rate = std::strtod(argv[++i], nullptr);
+        } else if (i + 1 < argc && (arg == "-d" || arg == "--duration")) {
+            opt.seconds = std::strtod(argv[++i], nullptr);
+        } else if (i + 1 < argc && (arg == "-F" || arg == "--files")) {
+            opt.files = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && (arg == "-m" || arg == "--max-level")) {
+            if (!parse_level(argv[++i], opt.maxLevel)) {
+                return false;
+            }
+        } else if (i + 1 < argc && (arg == "-i" || arg == "--interval-ms")) {
+            opt.interval = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && arg == "--dedup-ms") {
+            opt.dedupWindow = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && arg == "--index-bytes") {
+            opt.indexBlockBytes = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg == "-j" || arg == "--json") {
+            opt.json = true;
+        } else {
+            return false;
+        }
+    }
+    return opt.threads > 0 && opt.writers > 0 && opt.seconds > 0 && opt.interval.count() > 0
+        && opt.rate >= 0 && (opt.profile.empty() || opt.fromLog.empty());
+}
+
+void print_row(double t, double sentRate, double processedRate, const HandlerStats &stats,
+    const Histogram &latency, const Histogram &call)
+{
+    std::printf("%7.1f %11.0f %11.0f %10zu %10zu %9llu %9llu %9llu %9llu %9llu\n", t, sentRate, processedRate,
+        stats.queueDepth_, stats.peakQueueDepth_,
+        static_cast<unsigned long long>(latency.percentile(50) / 1000),
+        static_cast<unsigned long long>(latency.percentile(99) / 1000),
+        static_cast<unsigned long long>(latency.percentile(99.9) / 1000),
+        static_cast<unsigned long long>(call.percentile(99)),
+        static_cast<unsigned long long>(call.percentile(99.9)));
+    std::fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-p profile | -l app.log] [-o profile_out] [-r root_dir] [-s file|stream|none]"
+                     " [-c collector_socket] [-t threads] [-w writers] [-R msgs_per_sec] [-d seconds]"
+                     " [-F files] [-m max_level] [-i interval_ms] [-j] [--dedup-ms ms] [--index-bytes n]\n";
+        return 1;
+    }
+
+    Profile profile;
+    if (!opt.profile.empty()) {
+        if (!load_profile(opt.profile, profile)) {
+            std::cerr << "Unable to read the profile " << opt.profile << "\n";
+            return 1;
+        }
+    } else if (!opt.fromLog.empty()) {
+        if (!extract_profile(opt.fromLog, opt.files, profile)) {
+            std::cerr << "No messages found in " << opt.fromLog << "\n";
+            return 1;
+        }
+    } else {
+        profile = synthetic_profile();
+    }
+    if (!opt.saveProfile.empty()) {
+        if (!save_profile(opt.saveProfile, profile)) {
+            std::cerr << "Unable to write " << opt.saveProfile << "\n";
+            return 1;
+        }
+    }
+
+    std::error_code ec;
+    Handler handler(opt.root.c_str(), opt.maxLevel, g_nullStream, ec);
+    if (ec.value()) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+    if (opt.json) {
+        handler.output_format(OUTPUT_FORMAT_JSON);
+    }
+    if (opt.dedupWindow.count() != 0) {
+        handler.dedup_window(opt.dedupWindow);
+    }
+    if (opt.indexBlockBytes != 0) {
+        handler.index_block_bytes(opt.indexBlockBytes);
+    }
+    if (!opt.collector.empty()) {
+        handler.collector(opt.collector.c_str());
+    }
+
+    std::printf("%zu message classes, %u files, %zu s timeline, %u threads, %u writers, %.0f msgs/s for %.1f s\n",
+        profile.classes.size(), opt.files != 0 ? opt.files : profile.files, profile.timeline.size(),
+        opt.threads, opt.writers, opt.rate, opt.seconds);
+    std::printf("%7s %11s %11s %10s %10s %9s %9s %9s %9s %9s\n", "t_s", "sent/s", "written/s", "queue", "peak",
+        "p50_us", "p99_us", "p999_us", "call_p99", "call_p999");
+
+    std::atomic<bool> stopProducers{false};
+    std::atomic<bool> stopWriters{false};
+    std::vector<std::thread> writers;
+    for (unsigned w = 0; w < opt.writers; ++w) {
+        writers.emplace_back([&]() {
+            while (!stopWriters.load(std::memory_order_relaxed)) {
+                handler.process();
+            }
+        });
+    }
+
+    const auto start = load_clock::now();
+    std::vector<std::unique_ptr<ProducerStats>> producerStats;
+    std::vector<std::thread> producers;
+    for (unsigned t = 0; t < opt.threads; ++t) {
+        producerStats.push_back(std::make_unique<ProducerStats>());
+        producers.emplace_back(producer, std::ref(handler), std::cref(profile), std::cref(opt), t,
+            std::cref(stopProducers), start, std::ref(*producerStats.back()));
+    }
+
+    HandlerStats previous = handler.stats();
+    std::uint64_t previousSent = 0;
+    Histogram previousCall;
+    auto previousT = start;
+    const auto end = start + std::chrono::duration_cast<load_clock::duration>(std::chrono::duration<double>(opt.seconds));
+    for (auto next = start + opt.interval; next <= end + opt.interval / 2; next += opt.interval) {
+        std::this_thread::sleep_until(std::min(next, end));
+        const auto now = load_clock::now();
+        const double dt = std::chrono::duration<double>(now - previousT).count();
+        const HandlerStats stats = handler.stats();
+        std::uint64_t sent = 0;
+        const Histogram call = to_histogram(producerStats, sent);
+        const double t = std::chrono::duration<double>(now - start).count();
+        print_row(t, (sent - previousSent) / dt, (stats.processed_ - previous.processed_) / dt, stats,
+            interval_histogram(stats.latencyNs_, previous.latencyNs_), interval_histogram(call, previousCall));
+        previous = stats;
+        previousSent = sent;
+        previousCall = call;
+        previousT = now;
+        if (now >= end) {
+            break;
+        }
+    }
+
+    stopProducers = true;
+    for (std::thread &th : producers) {
+        th.join();
+    }
+    const auto stopped = load_clock::now();
+    const HandlerStats atStop = handler.stats();
+    while (handler.get_queue_ptr()->size() != 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    const auto drained = load_clock::now();
+    stopWriters = true;
+    for (std::thread &th : writers) {
+        th.join();
+    }
+
+    const HandlerStats stats = handler.stats();
+    std::uint64_t sent = 0;
+    const Histogram call = to_histogram(producerStats, sent);
+    const double runSeconds = std::chrono::duration<double>(stopped - start).count();
+    const double drainSeconds = std::chrono::duration<double>(drained - stopped).count();
+    // The queue is empty at t=0, so a run of a single interval has a growth too
+    const double growth = runSeconds > 0 ? static_cast<double>(atStop.queueDepth_) / runSeconds : 0;
+
+    std::printf("\nsent                %llu msgs, %.0f msgs/s\n", static_cast<unsigned long long>(sent), sent / runSeconds);
+    std::printf("written             %llu msgs, %.0f msgs/s sustained while producing\n",
+        static_cast<unsigned long long>(atStop.processed_), atStop.processed_ / runSeconds);
+    std::printf("filtered/dropped    %llu / %llu\n", static_cast<unsigned long long>(stats.filtered_),
+        static_cast<unsigned long long>(stats.dropped_));
+    std::printf("queue               %zu at stop, peak %zu, growth %.0f msgs/s, drained in %.3f s\n",
+        atStop.queueDepth_, stats.peakQueueDepth_, growth, drainSeconds);
+    std::printf("latency us          p50 %llu p99 %llu p999 %llu max %llu\n",
+        static_cast<unsigned long long>(stats.latencyNs_.percentile(50) / 1000),
+        static_cast<unsigned long long>(stats.latencyNs_.percentile(99) / 1000),
+        static_cast<unsigned long long>(stats.latencyNs_.percentile(99.9) / 1000),
+        static_cast<unsigned long long>(stats.latencyNs_.max_ / 1000));
+    std::printf("log() call ns       p50 %llu p99 %llu p999 %llu max %llu\n",
+        static_cast<unsigned long long>(call.percentile(50)), static_cast<unsigned long long>(call.percentile(99)),
+        static_cast<unsigned long long>(call.percentile(99.9)), static_cast<unsigned long long>(call.max_));
+    std::printf("file/stream MB/s    %.1f / %.1f\n", stats.file_.bytes_ / runSeconds / 1e6,
+        stats.stream_.bytes_ / runSeconds / 1e6);
+    // A queue that keeps growing, is left with messages at the stop or takes
+    // long to drain means the rate cannot be sustained
+    const char *reason = nullptr;
+    if (growth > 0.01 * (sent / runSeconds)) {
+        reason = "queue growing";
+    } else if (atStop.queueDepth_ != 0) {
+        reason = "messages queued at stop";
+    } else if (drainSeconds > kMaxDrainSeconds) {
+        reason = "slow drain";
+    }
+    if (reason != nullptr) {
+        std::printf("verdict             FALLING BEHIND (%s)\n", reason);
+    } else {
+        std::printf("verdict             keeps up\n");
+    }
+    return 0;
+}
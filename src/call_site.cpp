@@ -0,0 +1,207 @@
+#include "call_site.hpp"
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace tslogger
+{
+
+static std::atomic<SampledSite *> s_sampledSites{nullptr};
+
+void SampledSite::register_site()
+{
+    SampledSite *head = s_sampledSites.load(std::memory_order_relaxed);
+    do {
+        next_ = head;
+    } while (!s_sampledSites.compare_exchange_weak(head, this, std::memory_order_release, std::memory_order_relaxed));
+}
+
+SampledSite *sampled_sites()
+{
+    return s_sampledSites.load(std::memory_order_acquire);
+}
+
+namespace
+{
+
+struct CallSiteRule {
+    std::string file_;
+    std::string function_;
+    call_site_state_t state_;
+};
+
+// Guards the rules and the registration of new sites, the list itself is
+// read without it
+std::mutex s_callSiteMutex;
+std::vector<CallSiteRule> s_callSiteRules;
+std::atomic<CallSite *> s_callSites{nullptr};
+
+bool glob_match(std::string_view pattern, std::string_view text)
+{
+    // Backtracks to the last '*' only, which is enough for globs
+    std::size_t p = 0;
+    std::size_t t = 0;
+    std::size_t star = std::string_view::npos;
+    std::size_t starText = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            starText = t;
+        } else if (star != std::string_view::npos) {
+            p = star + 1;
+            t = ++starText;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+bool matches(const CallSiteRule &rule, const CallSite &site)
+{
+    if (!rule.file_.empty()) {
+        std::string_view file(site.file_);
+        if (rule.file_.find('/') == std::string::npos) {
+            const std::size_t slash = file.rfind('/');
+            if (slash != std::string_view::npos) {
+                file.remove_prefix(slash + 1);
+            }
+        }
+        if (!glob_match(rule.file_, file)) {
+            return false;
+        }
+    }
+    return rule.function_.empty() || glob_match(rule.function_, site.function_);
+}
+
+// Expects s_callSiteMutex to be held
+call_site_state_t state_for(const CallSite &site)
+{
+    for (auto it = s_callSiteRules.rbegin(); it != s_callSiteRules.rend(); ++it) {
+        if (matches(*it, site)) {
+            return it->state_;
+        }
+    }
+    return CALL_SITE_DEFAULT;
+}
+
+// Expects s_callSiteMutex to be held
+void apply_rules()
+{
+    for (CallSite *site = s_callSites.load(std::memory_order_acquire); site != nullptr; site = site->next_) {
+        site->state_.store(state_for(*site), std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+call_site_state_t CallSite::register_site()
+{
+    const std::lock_guard<std::mutex> lg(s_callSiteMutex);
+    // Another thread may have registered the site meanwhile
+    const auto current = static_cast<call_site_state_t>(state_.load(std::memory_order_relaxed));
+    if (current != CALL_SITE_UNREGISTERED) {
+        return current;
+    }
+    const call_site_state_t state = state_for(*this);
+    state_.store(state, std::memory_order_relaxed);
+    next_ = s_callSites.load(std::memory_order_relaxed);
+    s_callSites.store(this, std::memory_order_release);
+    return state;
+}
+
+CallSite *call_sites()
+{
+    return s_callSites.load(std::memory_order_acquire);
+}
+
+std::size_t set_call_sites(const char *filePattern, const char *functionPattern, call_site_state_t state)
+{
+    if (state == CALL_SITE_UNREGISTERED) {
+        return 0;
+    }
+    CallSiteRule rule{filePattern == nullptr ? "" : filePattern, functionPattern == nullptr ? "" : functionPattern, state};
+
+    const std::lock_guard<std::mutex> lg(s_callSiteMutex);
+    // A rule for the same patterns replaces the older one
+    for (auto it = s_callSiteRules.begin(); it != s_callSiteRules.end(); ++it) {
+        if (it->file_ == rule.file_ && it->function_ == rule.function_) {
+            s_callSiteRules.erase(it);
+            break;
+        }
+    }
+    std::size_t count = 0;
+    for (CallSite *site = s_callSites.load(std::memory_order_acquire); site != nullptr; site = site->next_) {
+        if (matches(rule, *site)) {
+            site->state_.store(state, std::memory_order_relaxed);
+            ++count;
+        }
+    }
+    s_callSiteRules.push_back(std::move(rule));
+    return count;
+}
+
+void reset_call_sites()
+{
+    const std::lock_guard<std::mutex> lg(s_callSiteMutex);
+    s_callSiteRules.clear();
+    apply_rules();
+}
+
+bool apply_call_site_rules(std::string_view text)
+{
+    std::vector<CallSiteRule> rules;
+    while (!text.empty()) {
+        std::size_t end = text.find('\n');
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+
+        // Up to three words: state, file pattern and function pattern
+        std::string_view words[4];
+        std::size_t count = 0;
+        while (count < 4) {
+            const std::size_t start = line.find_first_not_of(" \t\r");
+            if (start == std::string_view::npos) {
+                break;
+            }
+            line.remove_prefix(start);
+            const std::size_t stop = line.find_first_of(" \t\r");
+            words[count++] = line.substr(0, stop);
+            line.remove_prefix(stop == std::string_view::npos ? line.size() : stop);
+        }
+        if (count == 0 || words[0].front() == '#') {
+            continue;
+        }
+
+        CallSiteRule rule;
+        if (words[0] == "enable") {
+            rule.state_ = CALL_SITE_ENABLED;
+        } else if (words[0] == "disable") {
+            rule.state_ = CALL_SITE_DISABLED;
+        } else if (words[0] == "default") {
+            rule.state_ = CALL_SITE_DEFAULT;
+        } else {
+            return false;
+        }
+        if (count < 2 || count > 3) {
+            return false;
+        }
+        rule.file_ = words[1] == "*" ? "" : std::string(words[1]);
+        rule.function_ = count < 3 || words[2] == "*" ? "" : std::string(words[2]);
+        rules.push_back(std::move(rule));
+    }
+
+    const std::lock_guard<std::mutex> lg(s_callSiteMutex);
+    s_callSiteRules = std::move(rules);
+    apply_rules();
+    return true;
+}
+
+} // namespace tslogger
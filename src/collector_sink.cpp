@@ -0,0 +1,150 @@
+#include "collector_sink.hpp"
+
+#include <cstring>
+
+#include "platform.hpp"
+
+namespace tslogger
+{
+
+static constexpr std::size_t kFrameHeader = 2 * sizeof(std::uint32_t);
+
+static std::size_t frame_size(const char *frame)
+{
+    std::uint32_t sizes[2];
+    std::memcpy(sizes, frame, sizeof(sizes));
+    return kFrameHeader + sizes[0] + sizes[1];
+}
+
+CollectorSink::CollectorSink(std::string socketPath, std::size_t maxPending)
+    :
+      m_socketPath_{std::move(socketPath)},
+      m_maxPending_{maxPending},
+      m_fd_{-1},
+      m_nextConnect_{},
+      m_pending_{},
+      m_sent_{0},
+      m_frameStart_{0}
+{
+}
+
+CollectorSink::~CollectorSink()
+{
+    platform::close_socket(m_fd_);
+}
+
+void CollectorSink::append_frame(std::string &batch, std::string_view filename, std::string_view line)
+{
+    const std::uint32_t sizes[2] = {static_cast<std::uint32_t>(filename.size()), static_cast<std::uint32_t>(line.size())};
+    char header[kFrameHeader];
+    std::memcpy(header, sizes, sizeof(sizes));
+    batch.append(header, sizeof(header));
+    batch.append(filename);
+    batch.append(line);
+}
+
+void CollectorSink::send(std::string &batch, std::size_t frames, StatsCounters &counters)
+{
+    const std::lock_guard<std::mutex> lg(m_mutex_);
+    if (!batch.empty()) {
+        if (m_pending_.size() - m_sent_ + batch.size() > m_maxPending_) {
+            StatsCounters::add(counters.collector_.errors_, frames);
+            StatsCounters::add(counters.dropped_, frames);
+        } else {
+            // Compacted up to a frame boundary only, a partly sent frame
+            // must stay whole for drop_partial_frame()
+            if (m_frameStart_ != 0 && m_frameStart_ >= m_pending_.size() / 2) {
+                m_pending_.erase(0, m_frameStart_);
+                m_sent_ -= m_frameStart_;
+                m_frameStart_ = 0;
+            }
+            m_pending_.append(batch);
+            StatsCounters::add(counters.collector_.messages_, frames);
+            StatsCounters::add(counters.collector_.bytes_, batch.size());
+        }
+        batch.clear();
+    }
+    flush_pending(counters);
+}
+
+void CollectorSink::flush_pending(StatsCounters &counters)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (m_sent_ == m_pending_.size()) {
+        return;
+    }
+    const auto t0 = clock::now();
+    if (m_fd_ == -1) {
+        if (t0 < m_nextConnect_) {
+            return;
+        }
+        std::error_code ec;
+        m_fd_ = platform::connect_unix_socket(m_socketPath_, ec);
+        if (m_fd_ == -1) {
+            m_nextConnect_ = t0 + kReconnectDelay;
+            return;
+        }
+    }
+
+    while (m_sent_ < m_pending_.size()) {
+        std::error_code ec;
+        const long sent = platform::send_nonblocking(m_fd_, m_pending_.data() + m_sent_, m_pending_.size() - m_sent_, ec);
+        StatsCounters::add(counters.collector_.writeCalls_, 1);
+        if (sent > 0) {
+            m_sent_ += static_cast<std::size_t>(sent);
+            while (m_frameStart_ < m_sent_ && m_frameStart_ + frame_size(m_pending_.data() + m_frameStart_) <= m_sent_) {
+                m_frameStart_ += frame_size(m_pending_.data() + m_frameStart_);
+            }
+            continue;
+        }
+        if (sent < 0) {
+            // The collector went away: the frame it got only a part of is
+            // lost, the rest goes to the next connection
+            platform::close_socket(m_fd_);
+            m_fd_ = -1;
+            m_nextConnect_ = clock::now() + kReconnectDelay;
+            const std::size_t dropped = drop_partial_frame();
+            StatsCounters::add(counters.collector_.errors_, dropped);
+            StatsCounters::add(counters.dropped_, dropped);
+        }
+        break;
+    }
+    if (m_sent_ == m_pending_.size()) {
+        m_pending_.clear();
+        m_sent_ = 0;
+        m_frameStart_ = 0;
+    }
+
+    const auto t1 = clock::now();
+    StatsCounters::add(counters.collector_.writeNs_,
+        static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(t1 - t0).count()));
+}
+
+std::size_t CollectorSink::drop_partial_frame()
+{
+    std::size_t end = m_frameStart_;
+    std::size_t dropped = 0;
+    if (m_frameStart_ < m_sent_) {
+        end += frame_size(m_pending_.data() + m_frameStart_);
+        dropped = 1;
+    }
+    m_pending_.erase(0, end);
+    m_sent_ = 0;
+    m_frameStart_ = 0;
+    return dropped;
+}
+
+bool CollectorSink::has_pending() const
+{
+    const std::lock_guard<std::mutex> lg(m_mutex_);
+    return m_sent_ != m_pending_.size();
+}
+
+bool CollectorSink::connected() const
+{
+    const std::lock_guard<std::mutex> lg(m_mutex_);
+    return m_fd_ != -1;
+}
+
+} // namespace tslogger
@@ -0,0 +1,108 @@
+#include "fields.hpp"
+
+#include "format.hpp"
+#include "json.hpp"
+
+namespace tslogger::text
+{
+
+template<typename V>
+static bool read_bytes(std::string_view fields, std::size_t &pos, V &value)
+{
+    if (fields.size() - pos < sizeof(V)) {
+        return false;
+    }
+    std::memcpy(&value, fields.data() + pos, sizeof(V));
+    pos += sizeof(V);
+    return true;
+}
+
+bool next_field(std::string_view fields, std::size_t &pos, FieldView &field)
+{
+    if (fields.size() < pos + 2) {
+        return false;
+    }
+    const auto type = static_cast<field_type_t>(fields[pos]);
+    const std::size_t keySize = static_cast<unsigned char>(fields[pos + 1]);
+    pos += 2;
+    if (fields.size() - pos < keySize) {
+        return false;
+    }
+    field.type_ = type;
+    field.key_ = fields.substr(pos, keySize);
+    pos += keySize;
+
+    switch (type) {
+    case FIELD_INT:
+        return read_bytes(fields, pos, field.int_);
+    case FIELD_UINT:
+        return read_bytes(fields, pos, field.uint_);
+    case FIELD_DOUBLE:
+        return read_bytes(fields, pos, field.double_);
+    case FIELD_BOOL: {
+        std::uint8_t b = 0;
+        if (!read_bytes(fields, pos, b)) {
+            return false;
+        }
+        field.bool_ = b != 0;
+        return true;
+    }
+    case FIELD_STRING: {
+        std::uint32_t size = 0;
+        if (!read_bytes(fields, pos, size) || fields.size() - pos < size) {
+            return false;
+        }
+        field.string_ = fields.substr(pos, size);
+        pos += size;
+        return true;
+    }
+    }
+    return false;
+}
+
+static void append_field_value(std::string &out, const FieldView &field)
+{
+    switch (field.type_) {
+    case FIELD_INT:
+        append_value(out, field.int_);
+        break;
+    case FIELD_UINT:
+        append_value(out, field.uint_);
+        break;
+    case FIELD_DOUBLE:
+        append_json_number(out, field.double_);
+        break;
+    case FIELD_BOOL:
+        out.append(field.bool_ ? "true" : "false");
+        break;
+    case FIELD_STRING:
+        append_json_string(out, field.string_);
+        break;
+    }
+}
+
+void append_fields_text(std::string &out, std::string_view fields)
+{
+    std::size_t pos = 0;
+    FieldView field;
+    while (next_field(fields, pos, field)) {
+        out.push_back(' ');
+        out.append(field.key_);
+        out.push_back('=');
+        append_field_value(out, field);
+    }
+}
+
+void append_fields_json(std::string &out, std::string_view fields)
+{
+    std::size_t pos = 0;
+    FieldView field;
+    while (next_field(fields, pos, field)) {
+        out.push_back(',');
+        append_json_string(out, field.key_);
+        out.push_back(':');
+        append_field_value(out, field);
+    }
+}
+
+} // namespace tslogger::text
@@ -0,0 +1,106 @@
+#include "format.hpp"
+
+namespace tslogger::text
+{
+
+const char kDigitPairs[200] = {
+    '0','0','0','1','0','2','0','3','0','4','0','5','0','6','0','7','0','8','0','9',
+    '1','0','1','1','1','2','1','3','1','4','1','5','1','6','1','7','1','8','1','9',
+    '2','0','2','1','2','2','2','3','2','4','2','5','2','6','2','7','2','8','2','9',
+    '3','0','3','1','3','2','3','3','3','4','3','5','3','6','3','7','3','8','3','9',
+    '4','0','4','1','4','2','4','3','4','4','4','5','4','6','4','7','4','8','4','9',
+    '5','0','5','1','5','2','5','3','5','4','5','5','5','6','5','7','5','8','5','9',
+    '6','0','6','1','6','2','6','3','6','4','6','5','6','6','6','7','6','8','6','9',
+    '7','0','7','1','7','2','7','3','7','4','7','5','7','6','7','7','7','8','7','9',
+    '8','0','8','1','8','2','8','3','8','4','8','5','8','6','8','7','8','8','8','9',
+    '9','0','9','1','9','2','9','3','9','4','9','5','9','6','9','7','9','8','9','9',
+};
+
+static unsigned count_digits(std::uint64_t value)
+{
+    unsigned n = 1;
+    for (;;) {
+        if (value < 10) return n;
+        if (value < 100) return n + 1;
+        if (value < 1000) return n + 2;
+        if (value < 10000) return n + 3;
+        value /= 10000;
+        n += 4;
+    }
+}
+
+char *write_unsigned(char *out, std::uint64_t value)
+{
+    const unsigned digits = count_digits(value);
+    char *p = out + digits;
+    while (value >= 100) {
+        const unsigned idx = static_cast<unsigned>(value % 100) * 2;
+        value /= 100;
+        *--p = kDigitPairs[idx + 1];
+        *--p = kDigitPairs[idx];
+    }
+    if (value >= 10) {
+        const unsigned idx = static_cast<unsigned>(value) * 2;
+        *--p = kDigitPairs[idx + 1];
+        *--p = kDigitPairs[idx];
+    } else {
+        *--p = static_cast<char>('0' + value);
+    }
+    return out + digits;
+}
+
+char *write_signed(char *out, std::int64_t value)
+{
+    std::uint64_t magnitude = static_cast<std::uint64_t>(value);
+    if (value < 0) {
+        *out++ = '-';
+        magnitude = 0 - magnitude;
+    }
+    return write_unsigned(out, magnitude);
+}
+
+char *write_hex(char *out, std::uint64_t value)
+{
+    static const char digits[] = "0123456789abcdef";
+    unsigned n = 1;
+    while (n < 16 && (value >> (4 * n)) != 0) {
+        ++n;
+    }
+    *out++ = '0';
+    *out++ = 'x';
+    for (unsigned i = n; i-- > 0;) {
+        *out++ = digits[(value >> (4 * i)) & 0x0f];
+    }
+    return out;
+}
+
+// Shortest representation that round-trips, independent of the C locale
+template<typename F>
+static char *write_floating(char *out, char *last, F value)
+{
+    const std::to_chars_result res = std::to_chars(out, last, value);
+    return res.ec == std::errc() ? res.ptr : out;
+}
+
+char *write_double(char *out, char *last, float value)
+{
+    return write_floating(out, last, value);
+}
+
+char *write_double(char *out, char *last, double value)
+{
+    return write_floating(out, last, value);
+}
+
+char *write_double(char *out, char *last, long double value)
+{
+    return write_floating(out, last, value);
+}
+
+char *write_fixed(char *out, char *last, double value, int precision)
+{
+    const std::to_chars_result res = std::to_chars(out, last, value, std::chars_format::fixed, precision);
+    return res.ec == std::errc() ? res.ptr : out;
+}
+
+} // namespace tslogger::text
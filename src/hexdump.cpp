@@ -0,0 +1,208 @@
+#include "hexdump.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "format.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TS_LOGGER_HEXDUMP_X86 1
+#endif
+
+namespace tslogger::text
+{
+
+namespace
+{
+
+// Converts count bytes (a multiple of 16) to 2 * count hex digits and
+// count printable characters ('.' for everything outside 0x20..0x7e)
+using hex_kernel_t = void (*)(const std::uint8_t *src, std::size_t count, char *hex, char *ascii);
+
+const char kHexDigits[] = "0123456789abcdef";
+
+void hex_kernel_scalar(const std::uint8_t *src, std::size_t count, char *hex, char *ascii)
+{
+    for (std::size_t i = 0; i < count; ++i) {
+        const std::uint8_t b = src[i];
+        hex[2 * i] = kHexDigits[b >> 4];
+        hex[2 * i + 1] = kHexDigits[b & 0x0f];
+        ascii[i] = (b >= 0x20 && b < 0x7f) ? static_cast<char>(b) : '.';
+    }
+}
+
+#if defined(TS_LOGGER_HEXDUMP_X86) && defined(__SSE2__)
+
+inline __m128i nibbles_to_hex_sse2(__m128i n)
+{
+    // '0' + n, plus ('a' - '0' - 10) for n > 9
+    const __m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+    return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+}
+
+void hex_kernel_sse2(const std::uint8_t *src, std::size_t count, char *hex, char *ascii)
+{
+    const __m128i lowMask = _mm_set1_epi8(0x0f);
+    for (std::size_t i = 0; i < count; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), lowMask);
+        const __m128i lo = _mm_and_si128(v, lowMask);
+        const __m128i h0 = nibbles_to_hex_sse2(_mm_unpacklo_epi8(hi, lo));
+        const __m128i h1 = nibbles_to_hex_sse2(_mm_unpackhi_epi8(hi, lo));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + 2 * i), h0);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(hex + 2 * i + 16), h1);
+
+        // Signed compares: bytes >= 0x80 are negative and fail "> 0x1f"
+        const __m128i printable = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+        const __m128i a = _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, _mm_set1_epi8('.')));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(ascii + i), a);
+    }
+}
+
+#endif
+
+#if defined(TS_LOGGER_HEXDUMP_X86) && (defined(__GNUC__) || defined(__clang__))
+#define TS_LOGGER_HEXDUMP_AVX2 1
+
+__attribute__((target("avx2"))) inline __m256i nibbles_to_hex_avx2(__m256i n)
+{
+    const __m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+    return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letters);
+}
+
+__attribute__((target("avx2"))) void hex_kernel_avx2(const std::uint8_t *src, std::size_t count, char *hex, char *ascii)
+{
+    const __m256i lowMask = _mm256_set1_epi8(0x0f);
+    std::size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+        const __m256i lo = _mm256_and_si256(v, lowMask);
+        // Unpacks work per 128-bit lane: a = bytes 0-7 | 16-23, b = bytes 8-15 | 24-31
+        const __m256i a = nibbles_to_hex_avx2(_mm256_unpacklo_epi8(hi, lo));
+        const __m256i b = nibbles_to_hex_avx2(_mm256_unpackhi_epi8(hi, lo));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(hex + 2 * i), _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(hex + 2 * i + 32), _mm256_permute2x128_si256(a, b, 0x31));
+
+        const __m256i printable = _mm256_andnot_si256(
+            _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x7e)), _mm256_cmpgt_epi8(v, _mm256_set1_epi8(0x1f)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(ascii + i),
+            _mm256_blendv_epi8(_mm256_set1_epi8('.'), v, printable));
+    }
+    if (i < count) {
+        hex_kernel_scalar(src + i, count - i, hex + 2 * i, ascii + i);
+    }
+}
+
+#endif
+
+struct HexKernel {
+    hex_kernel_t fn_;
+    const char *name_;
+};
+
+HexKernel select_kernel()
+{
+#if defined(TS_LOGGER_HEXDUMP_AVX2)
+    if (__builtin_cpu_supports("avx2")) {
+        return {hex_kernel_avx2, "avx2"};
+    }
+#endif
+#if defined(TS_LOGGER_HEXDUMP_X86) && defined(__SSE2__)
+    return {hex_kernel_sse2, "sse2"};
+#else
+    return {hex_kernel_scalar, "scalar"};
+#endif
+}
+
+const HexKernel &kernel()
+{
+    static const HexKernel k = select_kernel();
+    return k;
+}
+
+// "00000010  " + 16 * "hh " + " " + " |" + 16 ascii + "|\n"
+constexpr std::size_t kLineLength = 10 + kHexDumpBytesPerLine * 3 + 1 + 2 + kHexDumpBytesPerLine + 2;
+
+char *write_line(char *p, std::size_t offset, const char *hex, const char *ascii, std::size_t bytes)
+{
+    for (int shift = 28; shift >= 0; shift -= 4) {
+        *p++ = kHexDigits[(offset >> shift) & 0x0f];
+    }
+    *p++ = ' ';
+    *p++ = ' ';
+    for (std::size_t i = 0; i < kHexDumpBytesPerLine; ++i) {
+        if (i < bytes) {
+            p[0] = hex[2 * i];
+            p[1] = hex[2 * i + 1];
+        } else {
+            p[0] = ' ';
+            p[1] = ' ';
+        }
+        p[2] = ' ';
+        p += 3;
+        if (i == kHexDumpBytesPerLine / 2 - 1) {
+            *p++ = ' ';
+        }
+    }
+    *p++ = ' ';
+    *p++ = '|';
+    std::memcpy(p, ascii, bytes);
+    p += bytes;
+    *p++ = '|';
+    *p++ = '\n';
+    return p;
+}
+
+} // namespace
+
+const char *hexdump_kernel_name()
+{
+    return kernel().name_;
+}
+
+void append_hexdump(std::string &out, const HexDump &dump)
+{
+    const std::size_t shown = std::min(dump.size_, dump.maxBytes_);
+    const std::size_t lines = (shown + kHexDumpBytesPerLine - 1) / kHexDumpBytesPerLine;
+
+    if (!out.empty() && out.back() != '\n') {
+        out.push_back('\n');
+    }
+
+    const std::size_t start = out.size();
+    out.resize(start + lines * kLineLength);
+    char *p = out.data() + start;
+
+    // Bytes are converted in chunks that fit on the stack, then laid out line by line
+    constexpr std::size_t kChunk = 512;
+    char hex[2 * kChunk];
+    char ascii[kChunk];
+    const hex_kernel_t fn = kernel().fn_;
+
+    for (std::size_t base = 0; base < shown; base += kChunk) {
+        const std::size_t chunk = std::min(kChunk, shown - base);
+        const std::size_t whole = chunk - chunk % kHexDumpBytesPerLine;
+        fn(dump.data_ + base, whole, hex, ascii);
+        if (whole < chunk) {
+            hex_kernel_scalar(dump.data_ + base + whole, chunk - whole, hex + 2 * whole, ascii + whole);
+        }
+        for (std::size_t i = 0; i < chunk; i += kHexDumpBytesPerLine) {
+            const std::size_t bytes = std::min(kHexDumpBytesPerLine, chunk - i);
+            p = write_line(p, base + i, hex + 2 * i, ascii + i, bytes);
+        }
+    }
+    out.resize(p - out.data());
+
+    if (shown < dump.size_) {
+        out.append("... truncated, ");
+        append_value(out, dump.size_ - shown);
+        out.append(" of ");
+        append_value(out, dump.size_);
+        out.append(" bytes not shown\n");
+    }
+}
+
+} // namespace tslogger::text
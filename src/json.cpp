@@ -0,0 +1,125 @@
+#include "json.hpp"
+
+#include <cmath>
+#include <cstdint>
+
+#include "format.hpp"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <emmintrin.h>
+#define TS_LOGGER_JSON_SSE2 1
+#endif
+
+namespace tslogger::text
+{
+
+namespace
+{
+
+inline bool needs_escape(unsigned char c)
+{
+    return c < 0x20 || c == '"' || c == '\\';
+}
+
+void append_escaped(std::string &out, unsigned char c)
+{
+    static const char kHexDigits[] = "0123456789abcdef";
+
+    switch (c) {
+    case '"':
+        out.append("\\\"");
+        break;
+    case '\\':
+        out.append("\\\\");
+        break;
+    case '\b':
+        out.append("\\b");
+        break;
+    case '\f':
+        out.append("\\f");
+        break;
+    case '\n':
+        out.append("\\n");
+        break;
+    case '\r':
+        out.append("\\r");
+        break;
+    case '\t':
+        out.append("\\t");
+        break;
+    default: {
+        const char u[6] = {'\\', 'u', '0', '0', kHexDigits[c >> 4], kHexDigits[c & 0x0f]};
+        out.append(u, sizeof(u));
+        break;
+    }
+    }
+}
+
+// Index of the first byte in [i, size) that needs escaping, or size
+std::size_t find_escape(const unsigned char *s, std::size_t i, std::size_t size)
+{
+#if defined(TS_LOGGER_JSON_SSE2)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    for (; i + 16 <= size; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i));
+        // min(v, 0x1f) == v exactly for the unsigned bytes below 0x20
+        const __m128i hits = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+            _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        const int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return i + static_cast<std::size_t>(__builtin_ctz(static_cast<unsigned>(mask)));
+        }
+    }
+#endif
+    for (; i < size; ++i) {
+        if (needs_escape(s[i])) {
+            return i;
+        }
+    }
+    return size;
+}
+
+} // namespace
+
+void append_json_string(std::string &out, std::string_view s)
+{
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(s.data());
+    const std::size_t size = s.size();
+
+    out.reserve(out.size() + size + 2);
+    out.push_back('"');
+    std::size_t i = 0;
+    while (i < size) {
+        const std::size_t next = find_escape(p, i, size);
+        out.append(s.data() + i, next - i);
+        if (next == size) {
+            break;
+        }
+        append_escaped(out, p[next]);
+        i = next + 1;
+    }
+    out.push_back('"');
+}
+
+void append_json_number(std::string &out, double value)
+{
+    if (!std::isfinite(value)) {
+        out.append("null");
+        return;
+    }
+    append_value(out, value);
+}
+
+const char *json_kernel_name()
+{
+#if defined(TS_LOGGER_JSON_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+} // namespace tslogger::text
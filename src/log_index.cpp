@@ -0,0 +1,249 @@
+#include "log_index.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+
+#include "logger_error.hpp"
+#include "platform.hpp"
+
+namespace tslogger
+{
+
+static constexpr std::size_t kIndexHeader = 16;
+static constexpr std::uint64_t kNsPerSecond = 1000000000;
+static constexpr std::uint32_t kAllLevels = 0xf;
+
+namespace
+{
+
+// Level and time range of the message a line belongs to
+struct LineInfo {
+    bool levelKnown_ = false;
+    std::uint32_t level_ = 0;
+    std::uint64_t firstNs_ = 0;
+    std::uint64_t lastNs_ = UINT64_MAX;
+};
+
+bool parse_level(std::string_view name, std::uint32_t &level)
+{
+    static const char *const kNames[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
+    for (std::uint32_t i = 0; i < 4; ++i) {
+        if (name == kNames[i]) {
+            level = i;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool is_date_time(std::string_view s)
+{
+    // "YYYY-MM-DD HH:MM:SS"
+    static const char kPattern[] = "dddd-dd-dd dd:dd:dd";
+    if (s.size() < sizeof(kPattern) - 1) {
+        return false;
+    }
+    for (std::size_t i = 0; i < sizeof(kPattern) - 1; ++i) {
+        const bool digit = s[i] >= '0' && s[i] <= '9';
+        if (kPattern[i] == 'd' ? !digit : s[i] != kPattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int digits(std::string_view s, std::size_t pos, std::size_t count)
+{
+    int value = 0;
+    for (std::size_t i = 0; i < count; ++i) {
+        value = value * 10 + (s[pos + i] - '0');
+    }
+    return value;
+}
+
+// Local date and time written by timestamp_to_date_time_string(), the
+// last conversion is cached since neighbouring lines share it
+std::uint64_t date_time_to_seconds(std::string_view s)
+{
+    thread_local char cachedText[19] = {};
+    thread_local std::uint64_t cachedSeconds = 0;
+    if (std::memcmp(cachedText, s.data(), sizeof(cachedText)) == 0) {
+        return cachedSeconds;
+    }
+
+    std::tm tm = {};
+    tm.tm_year = digits(s, 0, 4) - 1900;
+    tm.tm_mon = digits(s, 5, 2) - 1;
+    tm.tm_mday = digits(s, 8, 2);
+    tm.tm_hour = digits(s, 11, 2);
+    tm.tm_min = digits(s, 14, 2);
+    tm.tm_sec = digits(s, 17, 2);
+    tm.tm_isdst = -1;
+    const std::time_t t = std::mktime(&tm);
+    std::memcpy(cachedText, s.data(), sizeof(cachedText));
+    cachedSeconds = t < 0 ? 0 : static_cast<std::uint64_t>(t);
+    return cachedSeconds;
+}
+
+// Updates info from the line header, leaves it as it is for continuation lines
+void parse_line(std::string_view line, LineInfo &info)
+{
+    if (!line.empty() && line.front() == '[') {
+        const std::size_t close = line.find(']');
+        std::uint32_t level = 0;
+        if (close == std::string_view::npos || close > 8 || !parse_level(line.substr(1, close - 1), level)) {
+            return;
+        }
+        info = LineInfo();
+        info.levelKnown_ = true;
+        info.level_ = level;
+        if (line.size() > close + 2 && is_date_time(line.substr(close + 2))) {
+            const std::uint64_t seconds = date_time_to_seconds(line.substr(close + 2));
+            info.firstNs_ = seconds * kNsPerSecond;
+            info.lastNs_ = info.firstNs_ + kNsPerSecond - 1;
+        }
+        return;
+    }
+
+    static constexpr std::string_view kJsonLevel = "{\"level\":\"";
+    if (line.substr(0, kJsonLevel.size()) == kJsonLevel) {
+        const std::size_t end = line.find('"', kJsonLevel.size());
+        std::uint32_t level = 0;
+        if (end == std::string_view::npos || !parse_level(line.substr(kJsonLevel.size(), end - kJsonLevel.size()), level)) {
+            return;
+        }
+        info = LineInfo();
+        info.levelKnown_ = true;
+        info.level_ = level;
+        static constexpr std::string_view kTimeNs = "\"time_ns\":";
+        const std::size_t at = line.find(kTimeNs);
+        if (at != std::string_view::npos) {
+            std::uint64_t ns = 0;
+            for (std::size_t i = at + kTimeNs.size(); i < line.size() && line[i] >= '0' && line[i] <= '9'; ++i) {
+                ns = ns * 10 + static_cast<std::uint64_t>(line[i] - '0');
+            }
+            info.firstNs_ = ns;
+            info.lastNs_ = ns;
+        }
+    }
+}
+
+bool matches(const LineInfo &info, const LogQuery &query)
+{
+    if (info.levelKnown_ ? (query.levels_ & (1u << info.level_)) == 0 : (query.levels_ & kAllLevels) != kAllLevels) {
+        return false;
+    }
+    return info.lastNs_ >= query.fromNs_ && info.firstNs_ <= query.toNs_;
+}
+
+} // namespace
+
+LogIndexReader::LogIndexReader(const char *logPath, std::error_code &ec)
+    :
+      m_log_{nullptr},
+      m_logSize_{0},
+      m_index_{nullptr},
+      m_indexSize_{0},
+      m_entries_{nullptr},
+      m_entryCount_{0},
+      m_sorted_{false},
+      m_scanned_{0}
+{
+    if (logPath == nullptr) {
+        ec = make_system_error(EFAULT);
+        return;
+    }
+
+    const std::string path(logPath);
+    if (!platform::file_size(path, m_logSize_, ec)) {
+        return;
+    }
+    if (m_logSize_ != 0) {
+        m_log_ = static_cast<const char *>(platform::map_file_readonly(path, m_logSize_, ec));
+        if (m_log_ == nullptr) {
+            m_logSize_ = 0;
+            return;
+        }
+    }
+
+    // Without a usable index the whole log is one unindexed block
+    std::error_code indexEc;
+    m_index_ = platform::map_file_readonly(path + ".idx", m_indexSize_, indexEc);
+    if (m_index_ != nullptr) {
+        if (m_indexSize_ >= kIndexHeader && std::memcmp(m_index_, kLogIndexMagic, sizeof(kLogIndexMagic)) == 0) {
+            m_entries_ = reinterpret_cast<const LogIndexEntry *>(static_cast<const char *>(m_index_) + kIndexHeader);
+            m_entryCount_ = (m_indexSize_ - kIndexHeader) / sizeof(LogIndexEntry);
+            std::uint32_t version = 0;
+            std::memcpy(&version, static_cast<const char *>(m_index_) + sizeof(kLogIndexMagic), sizeof(version));
+            m_sorted_ = version >= 2;
+        }
+    }
+    ec.clear();
+}
+
+LogIndexReader::~LogIndexReader()
+{
+    platform::unmap_file(m_log_, m_logSize_);
+    platform::unmap_file(m_index_, m_indexSize_);
+}
+
+std::size_t LogIndexReader::query(const LogQuery &query, const std::function<void(std::string_view line)> &fn) const
+{
+    m_scanned_ = 0;
+    std::size_t found = 0;
+    std::size_t indexed = 0;
+    std::size_t first = 0;
+    if (m_sorted_ && query.fromNs_ != 0) {
+        // The blocks before it all end before fromNs_
+        first = static_cast<std::size_t>(std::partition_point(m_entries_, m_entries_ + m_entryCount_,
+            [&query](const LogIndexEntry &entry) { return entry.lastNs_ < query.fromNs_; }) - m_entries_);
+        if (first != 0) {
+            const LogIndexEntry &last = m_entries_[first - 1];
+            if (last.offset_ > m_logSize_ || last.size_ > m_logSize_ - last.offset_) {
+                // Truncated log, stop where the walk from the start would
+                first = 0;
+            } else {
+                indexed = last.offset_ + last.size_;
+            }
+        }
+    }
+    for (std::size_t i = first; i < m_entryCount_; ++i) {
+        const LogIndexEntry &entry = m_entries_[i];
+        if (entry.offset_ > m_logSize_ || entry.size_ > m_logSize_ - entry.offset_) {
+            // The log is shorter than its index, e.g. it was truncated
+            break;
+        }
+        indexed = entry.offset_ + entry.size_;
+        if ((entry.levels_ & query.levels_) == 0 || entry.lastNs_ < query.fromNs_ || entry.firstNs_ > query.toNs_) {
+            continue;
+        }
+        found += scan(entry.offset_, indexed, query, fn);
+    }
+    if (indexed < m_logSize_) {
+        found += scan(indexed, m_logSize_, query, fn);
+    }
+    return found;
+}
+
+std::size_t LogIndexReader::scan(std::size_t begin, std::size_t end, const LogQuery &query,
+    const std::function<void(std::string_view line)> &fn) const
+{
+    m_scanned_ += end - begin;
+    std::size_t found = 0;
+    LineInfo info;
+    while (begin < end) {
+        const void *nl = std::memchr(m_log_ + begin, '\n', end - begin);
+        const std::size_t lineEnd = nl == nullptr ? end : static_cast<std::size_t>(static_cast<const char *>(nl) - m_log_);
+        const std::string_view line(m_log_ + begin, lineEnd - begin);
+        parse_line(line, info);
+        if (matches(info, query)) {
+            fn(line);
+            ++found;
+        }
+        begin = lineEnd + 1;
+    }
+    return found;
+}
+
+} // namespace tslogger
@@ -0,0 +1,138 @@
+#include "log_shard.hpp"
+
+#include <cerrno>
+#include <memory>
+#include <queue>
+
+#include "format.hpp"
+#include "logger_error.hpp"
+
+namespace tslogger
+{
+
+// Larger records are taken for a corrupted size
+static constexpr std::uint64_t kMaxRecord = 64 * 1024 * 1024;
+
+void append_shard_record(std::string &out, std::uint64_t timestampNs, std::string_view line)
+{
+    text::append_value(out, timestampNs);
+    out.push_back(' ');
+    text::append_value(out, static_cast<std::uint64_t>(line.size()));
+    out.push_back(' ');
+    out.append(line);
+}
+
+void append_shard_path(std::string &out, std::string_view log, std::string_view threadId)
+{
+    out.append(log).append(".").append(threadId).append(".shard");
+}
+
+LogShardReader::LogShardReader(const char *path, std::error_code &ec)
+    :
+      m_buffer_(kReadBuffer),
+      m_timestampNs_{0}
+{
+    if (path == nullptr) {
+        ec = make_system_error(EFAULT);
+        return;
+    }
+    m_in_.rdbuf()->pubsetbuf(m_buffer_.data(), static_cast<std::streamsize>(m_buffer_.size()));
+    m_in_.open(path, std::ios::binary);
+    if (!m_in_) {
+        ec = make_system_error(errno != 0 ? errno : ENOENT);
+        return;
+    }
+    ec.clear();
+}
+
+bool LogShardReader::next(std::error_code &ec)
+{
+    ec.clear();
+    // Reads a decimal number ended by a space, false at the end of the shard
+    const auto read_number = [this](std::uint64_t &value, bool &any) {
+        value = 0;
+        any = false;
+        int c;
+        while ((c = m_in_.get()) != std::char_traits<char>::eof()) {
+            if (c == ' ') {
+                return any;
+            }
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            value = value * 10 + static_cast<std::uint64_t>(c - '0');
+            any = true;
+        }
+        return false;
+    };
+
+    bool any = false;
+    if (!read_number(m_timestampNs_, any)) {
+        if (any || !m_in_.eof()) {
+            ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_SHARD);
+        }
+        return false;
+    }
+    std::uint64_t size = 0;
+    if (!read_number(size, any) || size > kMaxRecord) {
+        ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_SHARD);
+        return false;
+    }
+    m_line_.resize(static_cast<std::size_t>(size));
+    if (!m_in_.read(m_line_.data(), static_cast<std::streamsize>(size))) {
+        ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_SHARD);
+        return false;
+    }
+    return true;
+}
+
+std::size_t merge_log_shards(const std::vector<std::string> &paths,
+    const std::function<void(std::string_view line)> &fn, std::error_code &ec,
+    std::vector<std::string> *failed)
+{
+    ec.clear();
+    // Keeps the first error, the shard is merged no further
+    const auto fail = [&ec, failed](const std::string &path, const std::error_code &error) {
+        if (!ec) {
+            ec = error;
+        }
+        if (failed != nullptr) {
+            failed->push_back(path);
+        }
+    };
+
+    std::vector<std::unique_ptr<LogShardReader>> readers;
+    readers.reserve(paths.size());
+    // Timestamp of the current record of each shard and its index, the
+    // index breaks the ties
+    using Head = std::pair<std::uint64_t, std::size_t>;
+    std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+    std::error_code error;
+    for (const std::string &path : paths) {
+        readers.push_back(std::make_unique<LogShardReader>(path.c_str(), error));
+        if (error.value()) {
+            fail(path, error);
+        } else if (readers.back()->next(error)) {
+            heads.emplace(readers.back()->timestamp_ns(), readers.size() - 1);
+        } else if (error.value()) {
+            fail(path, error);
+        }
+    }
+
+    std::size_t count = 0;
+    while (!heads.empty()) {
+        const std::size_t shard = heads.top().second;
+        heads.pop();
+        LogShardReader &reader = *readers[shard];
+        fn(reader.line());
+        ++count;
+        if (reader.next(error)) {
+            heads.emplace(reader.timestamp_ns(), shard);
+        } else if (error.value()) {
+            fail(paths[shard], error);
+        }
+    }
+    return count;
+}
+
+} // namespace tslogger
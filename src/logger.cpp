@@ -1,13 +1,71 @@
+#include <algorithm>
 #include <cstdarg>
 #include <ctime>
+#include <limits>
 
+#include "json.hpp"
 #include "logger.hpp"
 
 namespace tslogger
 {
 
-bool Handler::s_init = false;
-std::mutex Handler::s_mutex;
+// Handler ids are never reused, so a thread-local cache entry of a
+// destroyed handler cannot match a new one
+static std::atomic<std::uint64_t> s_handlerId{1};
+
+namespace
+{
+
+// Parameters of the thread loggers returned by default_logger()
+struct DefaultTarget {
+    std::mutex mutex_;
+    // Cleared by the handler's destructor before it goes
+    Handler *handler_ = nullptr;
+    std::string filename_;
+    flags_t flags_ = FLAGS_OUTPUT_TO_FILE_ONLY;
+    line_format_t format_ = LINE_FORMAT_ALL;
+};
+
+// Never destroyed, threads may still log while statics are destroyed
+DefaultTarget &default_target()
+{
+    static DefaultTarget *s_target = new DefaultTarget();
+    return *s_target;
+}
+
+// Changed under DefaultTarget::mutex_ whenever the target changes, the
+// thread loggers are recreated when they see a new value
+std::atomic<std::uint64_t> s_defaultGeneration{0};
+
+} // namespace
+
+Logger *default_logger()
+{
+    thread_local std::unique_ptr<Logger> logger;
+    thread_local std::uint64_t generation = 0;
+    if (s_defaultGeneration.load(std::memory_order_acquire) != generation) {
+        DefaultTarget &target = default_target();
+        const std::lock_guard<std::mutex> lg(target.mutex_);
+        logger.reset();
+        if (target.handler_ != nullptr) {
+            logger = std::make_unique<Logger>(*target.handler_,
+                target.filename_.empty() ? nullptr : target.filename_.c_str(), target.flags_, target.format_);
+        }
+        generation = s_defaultGeneration.load(std::memory_order_relaxed);
+    }
+    return logger.get();
+}
+
+static std::int64_t steady_ns(std::chrono::steady_clock::time_point t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t.time_since_epoch()).count();
+}
+
+static std::uint64_t system_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
 time_t timestamp()
 {
@@ -50,13 +108,343 @@ const char *log_level_to_string(log_level_t level)
     }
 }
 
+// Same output as "%f" in printf, but without the locale lookup of std::to_string
+static void append_fixed(std::string &out, double value)
+{
+    char buf[std::numeric_limits<double>::max_exponent10 + 16];
+    out.append(buf, text::write_fixed(buf, buf + sizeof(buf), value, 6) - buf);
+}
+
+// Shards of the Loggers created from a Handler, written by their producer
+// threads. Each thread keeps its shards open in a ShardThread that only it
+// writes; the mutex of a ShardThread is only contended by flush() and
+// close(). A closed sink, or a handler not in thread shard mode, leaves the
+// messages to the queue.
+class ShardSink {
+public:
+    explicit ShardSink(Handler &handler)
+        : m_handler_{&handler}
+    {
+    }
+
+    ShardSink(const ShardSink &) = delete;
+    ShardSink &operator=(const ShardSink &) = delete;
+
+    // Writes the file line of msg to the calling thread's shard, false if
+    // msg has to go through the queue instead
+    bool write(const std::shared_ptr<ShardSink> &self, Message &msg);
+    // Writes out the records buffered by every thread
+    void flush(StatsCounters &counters);
+    // Writes out and closes every shard, the handler is gone afterwards
+    void close(StatsCounters &counters);
+
+    // Handler::thread_shards(), read before anything else
+    std::atomic<bool> enabled_{false};
+
+private:
+    struct ShardFile {
+        // Root directory the shard was opened in
+        std::string root_;
+        int fd_ = -1;
+        std::string buffer_;
+        std::size_t records_ = 0;
+    };
+
+    struct ShardThread {
+        std::mutex mutex_;
+        bool closed_ = false;
+        std::string threadId_;
+        // By Logger filename
+        std::unordered_map<std::string, ShardFile> files_;
+    };
+
+    // Shard threads of the calling thread, one per sink it wrote to;
+    // closed when the thread exits
+    struct ThreadShards {
+        std::vector<std::pair<std::shared_ptr<ShardSink>, std::shared_ptr<ShardThread>>> entries_;
+
+        ~ThreadShards()
+        {
+            for (auto &entry : entries_) {
+                entry.first->release(*entry.second);
+            }
+        }
+    };
+
+    ShardThread &this_thread(const std::shared_ptr<ShardSink> &self);
+    void write_record(const HandlerConfig &config, ShardThread &thread, Message &msg, StatsCounters &counters);
+    static void write_out(ShardFile &file, StatsCounters &counters);
+    // ShardThread::mutex_ is held
+    static void close_files(ShardThread &thread, StatsCounters &counters);
+    void release(ShardThread &thread);
+
+private:
+    Handler *m_handler_;
+    std::mutex m_mutex_;
+    bool m_closed_ = false;
+    std::vector<std::shared_ptr<ShardThread>> m_threads_;
+};
+
+ShardSink::ShardThread &ShardSink::this_thread(const std::shared_ptr<ShardSink> &self)
+{
+    thread_local ThreadShards shards;
+    for (const auto &entry : shards.entries_) {
+        if (entry.first.get() == this) {
+            return *entry.second;
+        }
+    }
+
+    // The entries of closed sinks are dropped, so that their handlers'
+    // memory is given back
+    shards.entries_.erase(std::remove_if(shards.entries_.begin(), shards.entries_.end(),
+        [](const auto &entry) {
+            const std::lock_guard<std::mutex> lg(entry.second->mutex_);
+            return entry.second->closed_;
+        }), shards.entries_.end());
+
+    auto thread = std::make_shared<ShardThread>();
+    thread->threadId_ = platform::thread_id_to_string(this_thread_id());
+    {
+        const std::lock_guard<std::mutex> lg(m_mutex_);
+        if (m_closed_) {
+            thread->closed_ = true;
+        } else {
+            m_threads_.push_back(thread);
+        }
+    }
+    shards.entries_.emplace_back(self, thread);
+    return *thread;
+}
+
+bool ShardSink::write(const std::shared_ptr<ShardSink> &self, Message &msg)
+{
+    if (!enabled_.load(std::memory_order_relaxed) || (msg.flags_ & (1 << OUTPUT_TO_FILE_BIT)) == 0) {
+        return false;
+    }
+    ShardThread &thread = this_thread(self);
+    const std::lock_guard<std::mutex> lg(thread.mutex_);
+    // close() takes every thread's mutex, so the handler outlives this call
+    if (thread.closed_) {
+        return false;
+    }
+
+    Handler &handler = *m_handler_;
+    Handler::ThreadState &state = handler.this_thread_state();
+    // The thread may log from within process(), e.g. from a formatter
+    const std::uint64_t epoch = state.configEpoch_.load();
+    if (epoch == UINT64_MAX) {
+        state.configEpoch_.store(handler.m_configEpoch_.load());
+    }
+    const HandlerConfig &config = *handler.m_config_.load();
+    const bool sharded = config.threadShards_ && !config.collector_;
+    if (sharded) {
+        write_record(config, thread, msg, state.counters_);
+    }
+    state.configEpoch_.store(epoch);
+    return sharded;
+}
+
+void ShardSink::write_record(const HandlerConfig &config, ShardThread &thread, Message &msg, StatsCounters &counters)
+{
+    if (Handler::is_filtered(config, msg)) {
+        StatsCounters::add(counters.filtered_, 1);
+        return;
+    }
+    if (msg.flags_ & (1 << OUTPUT_TO_STREAM_BIT)) {
+        Message copy = msg;
+        copy.flags_ = FLAGS_OUTPUT_TO_STREAM_ONLY;
+        const bool urgent = static_cast<int>(copy.logLevel_) <= TS_LOGGER_URGENT_LEVEL || copy.replayed_;
+        m_handler_->m_queuePtr_->push(std::move(copy), urgent);
+    }
+
+    ShardFile &file = thread.files_[msg.filename_];
+    if (file.fd_ == -1 || file.root_ != config.root_) {
+        write_out(file, counters);
+        platform::close_file(file.fd_);
+        std::string path(config.root_);
+        path.append("/");
+        append_shard_path(path, msg.filename_, thread.threadId_);
+        std::error_code ec;
+        file.fd_ = platform::open_append(path, ec);
+        file.root_ = config.root_;
+        if (file.fd_ == -1) {
+            StatsCounters::add(counters.processed_, 1);
+            StatsCounters::add(counters.file_.errors_, 1);
+            StatsCounters::add(counters.dropped_, 1);
+            return;
+        }
+    }
+
+    thread_local std::string line;
+    line.clear();
+    Handler::output_log(msg, config.outputFormat_, line);
+    append_shard_record(file.buffer_, msg.timestampNs_, line);
+    ++file.records_;
+    if (file.buffer_.size() >= config.fileBufferBytes_) {
+        write_out(file, counters);
+    }
+
+    StatsCounters::add(counters.processed_, 1);
+    const std::uint64_t now = system_ns();
+    counters.add_latency(now > msg.timestampNs_ ? now - msg.timestampNs_ : 0);
+}
+
+void ShardSink::write_out(ShardFile &file, StatsCounters &counters)
+{
+    using clock = std::chrono::steady_clock;
+
+    if (file.buffer_.empty()) {
+        return;
+    }
+    std::error_code ec;
+    std::size_t writeCalls = 0;
+    const auto t0 = clock::now();
+    const bool ok = platform::write_all(file.fd_, file.buffer_, ec, &writeCalls);
+    StatsCounters::add(counters.file_.writeNs_, steady_ns(clock::now()) - steady_ns(t0));
+    StatsCounters::add(counters.file_.writeCalls_, writeCalls);
+    if (ok) {
+        StatsCounters::add(counters.file_.messages_, file.records_);
+        StatsCounters::add(counters.file_.bytes_, file.buffer_.size());
+    } else {
+        StatsCounters::add(counters.file_.errors_, file.records_);
+        StatsCounters::add(counters.dropped_, file.records_);
+    }
+    file.buffer_.clear();
+    file.records_ = 0;
+}
+
+void ShardSink::close_files(ShardThread &thread, StatsCounters &counters)
+{
+    for (auto &entry : thread.files_) {
+        write_out(entry.second, counters);
+        platform::close_file(entry.second.fd_);
+    }
+    thread.files_.clear();
+    thread.closed_ = true;
+}
+
+void ShardSink::flush(StatsCounters &counters)
+{
+    std::vector<std::shared_ptr<ShardThread>> threads;
+    {
+        const std::lock_guard<std::mutex> lg(m_mutex_);
+        threads = m_threads_;
+    }
+    for (const auto &thread : threads) {
+        const std::lock_guard<std::mutex> lg(thread->mutex_);
+        for (auto &entry : thread->files_) {
+            write_out(entry.second, counters);
+        }
+    }
+}
+
+void ShardSink::close(StatsCounters &counters)
+{
+    enabled_ = false;
+    const std::lock_guard<std::mutex> lg(m_mutex_);
+    m_closed_ = true;
+    for (const auto &thread : m_threads_) {
+        const std::lock_guard<std::mutex> threadLock(thread->mutex_);
+        close_files(*thread, counters);
+    }
+    m_threads_.clear();
+}
+
+void ShardSink::release(ShardThread &thread)
+{
+    {
+        const std::lock_guard<std::mutex> lg(thread.mutex_);
+        if (!thread.closed_) {
+            close_files(thread, m_handler_->this_thread_state().counters_);
+        }
+    }
+    const std::lock_guard<std::mutex> lg(m_mutex_);
+    m_threads_.erase(std::remove_if(m_threads_.begin(), m_threads_.end(),
+        [&thread](const auto &entry) { return entry.get() == &thread; }), m_threads_.end());
+}
+
+Logger::Logger(Handler &handler, const char *filename, flags_t flags, line_format_t format)
+    : Logger(handler.m_queuePtr_, filename, flags, format)
+{
+    m_shardsPtr_ = handler.m_shards_;
+}
+
+void Logger::flight_recorder(std::size_t capacity, log_level_t threshold)
+{
+    flush_flight_recorder();
+    m_recorder_.clear();
+    m_recorder_.shrink_to_fit();
+    m_recorder_.resize(capacity);
+    m_recorderLevel_ = threshold;
+}
+
+void Logger::flush_flight_recorder()
+{
+    const std::size_t capacity = m_recorder_.size();
+    std::size_t slot = (m_recorderNext_ + capacity - m_recorderCount_) % (capacity == 0 ? 1 : capacity);
+    for (; m_recorderCount_ != 0; --m_recorderCount_) {
+        Message &msg = m_recorder_[slot];
+        msg.replayed_ = true;
+        send(std::move(msg));
+        msg = Message();
+        slot = (slot + 1) % capacity;
+    }
+    m_recorderNext_ = 0;
+}
+
+bool Logger::record(Message &msg)
+{
+    if (msg.logLevel_ > m_recorderLevel_) {
+        // Swapping reuses the buffers of the overwritten message
+        std::swap(m_recorder_[m_recorderNext_], msg);
+        m_recorderNext_ = (m_recorderNext_ + 1) % m_recorder_.size();
+        if (m_recorderCount_ < m_recorder_.size()) {
+            ++m_recorderCount_;
+        }
+        return true;
+    }
+    if (msg.logLevel_ == ERROR) {
+        flush_flight_recorder();
+    }
+    return false;
+}
+
+void Logger::send(Message &&msg)
+{
+    if (m_ringPtr_) {
+        m_ringPtr_->push(msg);
+        return;
+    }
+    if (m_shardsPtr_ && m_shardsPtr_->write(m_shardsPtr_, msg)) {
+        return;
+    }
+    // Replayed messages are the context of an urgent one, they must not
+    // fall behind it
+    const bool urgent = static_cast<int>(msg.logLevel_) <= TS_LOGGER_URGENT_LEVEL || msg.replayed_;
+    m_queuePtr_->push(std::move(msg), urgent);
+}
+
 void Logger::log(log_level_t level, const char *fmt, ...)
 {
-    Message msg;
-    fill_message_common_parameters(level, msg);
+    std::va_list args;
+    va_start(args, fmt);
+    vlog(level, false, fmt, args);
+    va_end(args);
+}
 
+void Logger::log(call_site_state_t site, log_level_t level, const char *fmt, ...)
+{
     std::va_list args;
     va_start(args, fmt);
+    vlog(level, site == CALL_SITE_ENABLED, fmt, args);
+    va_end(args);
+}
+
+void Logger::vlog(log_level_t level, bool forced, const char *fmt, std::va_list args)
+{
+    Message msg;
+    fill_message_common_parameters(level, msg);
+    msg.forced_ = forced;
 
     for (const char *s = fmt; *s != '\0'; ++s) {
         switch (*s) {
@@ -64,178 +452,1068 @@ void Logger::log(log_level_t level, const char *fmt, ...)
             switch (*++s) {
             case 'd':
             case 'i':
-                msg.message.append(std::to_string(va_arg(args, int)));
+                text::append_value(msg.message_, va_arg(args, int));
                 continue;
             case 'F':
             case 'f':
-                msg.message.append(std::to_string(va_arg(args, double)));
+                append_fixed(msg.message_, va_arg(args, double));
                 continue;
             case 's':
-                msg.message.append(std::string(va_arg(args, const char *)));
+                text::append(msg.message_, va_arg(args, const char *), m_maxElements_);
                 continue;
             case 'c':
-                msg.message.push_back(static_cast<char>(va_arg(args, int)));
+                msg.message_.push_back(static_cast<char>(va_arg(args, int)));
                 continue;
             case '%':
-                msg.message.append("%");
+                msg.message_.append("%");
                 continue;
             case 'x':
             case 'X':
-                msg.message.append(to_hex_string(va_arg(args, unsigned int)));
+                text::append_hex(msg.message_, va_arg(args, unsigned int));
                 continue;
             case 'u':
-                msg.message.append(std::to_string(va_arg(args, unsigned int)));
+                text::append_value(msg.message_, va_arg(args, unsigned int));
                 continue;
             default:
-                msg.message.push_back('%');
-                msg.message.push_back(*s);
+                msg.message_.push_back('%');
+                msg.message_.push_back(*s);
                 continue;
             }
         case '\n':
-            msg.message.append("\n");
+            msg.message_.append("\n");
             continue;
         case '\t':
-            msg.message.append("\t");
+            msg.message_.append("\t");
             continue;
         default:
-            msg.message.push_back(*s);
+            msg.message_.push_back(*s);
         }
     }
-    va_end(args);
-    m_queuePtr->push(msg);
+    push(std::move(msg));
 }
 
-Logger &Logger::operator<<(char &v)
+Handler::Handler(const char *root, log_level_t maxLevel, std::ostream &stream, std::error_code &ec)
+    :
+      m_queuePtr_{std::make_shared<SafeQueue<Message>>()},
+      m_shards_{std::make_shared<ShardSink>(*this)},
+      m_stream_{stream},
+      m_id_{s_handlerId.fetch_add(1)},
+      m_config_{nullptr},
+      m_configEpoch_{0},
+      m_configOwner_{std::make_unique<HandlerConfig>()},
+      m_nextTimer_{INT64_MAX}
 {
-    Message msg;
-    fill_message_common_parameters(default_level(), msg);
-    msg.message.push_back(v);
-    m_queuePtr->push(msg);
-    return *this;
+    m_configOwner_->root_ = root == nullptr ? "" : root;
+    m_configOwner_->maxLevel_ = maxLevel;
+    m_config_ = m_configOwner_.get();
+
+    if (root == nullptr) {
+        ec = make_system_error(EFAULT);
+        return;
+    }
+
+    if (!platform::create_directories(m_configOwner_->root_, ec) || !platform::is_directory(m_configOwner_->root_, ec)) {
+        if (!ec) {
+            ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_NOT_DIRECTORY);
+        }
+        return;
+    }
+
+    ec.clear();
 }
 
-Logger &Logger::operator<<(char *v)
+Handler::~Handler()
 {
-    Message msg;
-    fill_message_common_parameters(default_level(), msg);
-    msg.message.append(v == nullptr ? "<null>" : v);
-    m_queuePtr->push(msg);
-    return *this;
+    {
+        DefaultTarget &target = default_target();
+        const std::lock_guard<std::mutex> lg(target.mutex_);
+        if (target.handler_ == this) {
+            target.handler_ = nullptr;
+            s_defaultGeneration.fetch_add(1, std::memory_order_release);
+        }
+    }
+    m_shards_->close(this_thread_state().counters_);
+    formatter_threads(0);
+    if (m_jobCount_.load() != 0) {
+        ThreadState &state = this_thread_state();
+        state.configEpoch_.store(m_configEpoch_.load());
+        write_jobs(*m_config_.load(), state, 0);
+        state.configEpoch_.store(UINT64_MAX);
+    }
+    flush();
+    const std::lock_guard<std::mutex> lg(m_fileMutex_);
+    close_index_blocks();
 }
 
-Logger &Logger::operator<<(const char *v)
+void Handler::output_log(const Message &msg, output_format_t format, std::string &out)
 {
-    return operator<<(const_cast<char *>(v));
+    if (msg.traceEvent_) {
+        out.append(msg.message_);
+    } else if (format == OUTPUT_FORMAT_JSON) {
+        output_json(msg, out);
+    } else {
+        output_text(msg, out);
+    }
 }
 
-Logger &Logger::operator<<(std::string &v)
+void Handler::output_text(const Message &msg, std::string &out)
 {
-    return operator<<(v.c_str());
+    if (msg.format_ & (1 << LEVEL_BIT)) {
+        out.push_back('[');
+        out.append(log_level_to_string(msg.logLevel_));
+        out.append("] ");
+    }
+    if (msg.format_ & (1 << TIMESTAMP_BIT)) {
+        std::string ts;
+        timestamp_to_date_time_string(msg.timestamp_, ts);
+        out.append(ts);
+        out.push_back(' ');
+    }
+    if (msg.format_ & (1 << THREAD_ID_BIT)) {
+        out.append("thread_id: ");
+        out.append(platform::thread_id_to_string(msg.threadId_));
+        out.push_back(' ');
+    }
+    if (msg.fields_.empty()) {
+        out.append(msg.message_);
+        return;
+    }
+    // The fields go before the line break that ends the message
+    std::string_view body(msg.message_);
+    const bool newline = !body.empty() && body.back() == '\n';
+    if (newline) {
+        body.remove_suffix(1);
+    }
+    out.append(body);
+    text::append_fields_text(out, msg.fields_);
+    if (newline) {
+        out.push_back('\n');
+    }
 }
 
-Logger &Logger::operator<<(std::vector<char> &v)
+void Handler::output_json(const Message &msg, std::string &out)
 {
-    Message msg;
-    fill_message_common_parameters(default_level(), msg);
+    out.push_back('{');
+    if (msg.format_ & (1 << LEVEL_BIT)) {
+        out.append("\"level\":\"");
+        out.append(log_level_to_string(msg.logLevel_));
+        out.append("\",");
+    }
+    if (msg.format_ & (1 << TIMESTAMP_BIT)) {
+        std::string ts;
+        timestamp_to_date_time_string(msg.timestamp_, ts);
+        out.append("\"time\":");
+        text::append_json_string(out, ts);
+        out.append(",\"time_ns\":");
+        text::append_value(out, msg.timestampNs_);
+        out.push_back(',');
+    }
+    if (msg.format_ & (1 << THREAD_ID_BIT)) {
+        out.append("\"thread_id\":");
+        text::append_json_string(out, platform::thread_id_to_string(msg.threadId_));
+        out.push_back(',');
+    }
+    if (!msg.category_.empty()) {
+        out.append("\"category\":");
+        text::append_json_string(out, msg.category_);
+        out.push_back(',');
+    }
+    std::string_view body(msg.message_);
+    if (!body.empty() && body.back() == '\n') {
+        body.remove_suffix(1);
+    }
+    out.append("\"msg\":");
+    text::append_json_string(out, body);
+    text::append_fields_json(out, msg.fields_);
+    out.append("}\n");
+}
 
-    msg.message.append("{ ");
-    if (v.empty()) {
-        msg.message.append("}");
-        m_queuePtr->push(msg);
-        return *this;
+Handler::ThreadState &Handler::this_thread_state()
+{
+    // A thread may serve or flush several handlers, the states of the
+    // last few are looked up without taking m_statsMutex_
+    struct Cache {
+        std::uint64_t handlerId = 0;
+        ThreadState *state = nullptr;
+    };
+    constexpr std::size_t kCacheSize = 4;
+    thread_local Cache cache[kCacheSize];
+    thread_local std::size_t nextEntry = 0;
+
+    for (const Cache &entry : cache) {
+        if (entry.handlerId == m_id_) {
+            return *entry.state;
+        }
     }
-    for (std::size_t i = 0; i < v.size(); ++i) {
-        if (i && i % 16 == 0)
-            msg.message.append("\n");
-        msg.message.push_back(static_cast<char>(v[i]));
-        msg.message.append(i + 1 < v.size() ? ", " : " }");
+
+    const std::thread::id self = std::this_thread::get_id();
+    const std::lock_guard<std::mutex> lg(m_statsMutex_);
+    auto it = std::find_if(m_threads_.begin(), m_threads_.end(),
+        [&self](const auto &entry) { return entry.first == self; });
+    if (it == m_threads_.end()) {
+        m_threads_.emplace_back(self, std::make_unique<ThreadState>());
+        it = std::prev(m_threads_.end());
     }
-    m_queuePtr->push(msg);
-    return *this;
+    cache[nextEntry] = {m_id_, it->second.get()};
+    nextEntry = (nextEntry + 1) % kCacheSize;
+    return *it->second;
 }
 
-Handler::Handler(const char *root, log_level_t maxLevel, std::ostream &stream, std::error_code &ec)
-    :
-      m_root{root == nullptr ? "" : root},
-      m_maxLevel{maxLevel},
-      m_queuePtr{std::make_shared<SafeQueue<Message>>()},
-      m_stream{stream}
+static std::uint64_t message_hash(const Message &msg)
 {
-    if (root == nullptr) {
-        ec = make_system_error(EFAULT);
-        return;
+    std::uint64_t h = std::hash<std::string_view>{}(msg.message_);
+    if (!msg.fields_.empty()) {
+        h = h * 31 + std::hash<std::string_view>{}(msg.fields_);
     }
+    return h ^ (static_cast<std::uint64_t>(msg.logLevel_) + 1) * 0x9E3779B97F4A7C15ull;
+}
 
-    std::lock_guard<std::mutex> lg(s_mutex);
-    if (s_init) {
-        ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_SINGLE_INSTANCE);
-        return;
+bool Handler::write_to_file(const HandlerConfig &config, const Message &msg, const std::string &path,
+    const std::string &line, ThreadState &state)
+{
+    if (config.collector_) {
+        CollectorSink::append_frame(state.collectorBatch_, msg.filename_, line);
+        ++state.collectorFrames_;
+        return true;
+    }
+    if (msg.traceEvent_ && !config.threadShards_ && open_trace_file(path)) {
+        thread_local std::string opened;
+        opened.assign("[\n").append(line);
+        return write_file_data(config, msg, path, opened, config.indexBlockBytes_, state);
     }
+    if (config.threadShards_) {
+        // The shard records are not indexed, the index reader expects lines
+        thread_local std::string record;
+        record.clear();
+        append_shard_record(record, msg.timestampNs_, line);
+        return write_file_data(config, msg, path, record, 0, state);
+    }
+    return write_file_data(config, msg, path, line, config.indexBlockBytes_, state);
+}
 
-    if (!platform::create_directories(m_root, ec) || !platform::is_directory(m_root, ec)) {
-        if (!ec) {
-            ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_NOT_DIRECTORY);
+bool Handler::open_trace_file(const std::string &path)
+{
+    const std::lock_guard<std::mutex> lg(m_fileMutex_);
+    if (!m_traceFiles_.insert(path).second) {
+        return false;
+    }
+    // A file that already has lines, written or buffered, was opened before
+    std::error_code ec;
+    std::size_t size = 0;
+    if (platform::file_size(path, size, ec) && size != 0) {
+        return false;
+    }
+    const auto it = m_fileBuffers_.find(path);
+    return it == m_fileBuffers_.end() || it->second.data_.empty();
+}
+
+bool Handler::write_file_data(const HandlerConfig &config, const Message &msg, const std::string &path,
+    const std::string &line, std::size_t indexBlockBytes, ThreadState &state)
+{
+    using clock = std::chrono::steady_clock;
+
+    StatsCounters &counters = state.counters_;
+    std::unique_lock<std::mutex> fileLock;
+    const bool indexReset = config.indexGeneration_ > m_indexGeneration_.load(std::memory_order_relaxed);
+    if (config.fileBufferBytes_ != 0 || indexBlockBytes != 0 || indexReset) {
+        // Lines reach the file in the same order as their index updates
+        fileLock = std::unique_lock<std::mutex>(m_fileMutex_);
+    }
+    // Done by the first write that sees the new setting, as the caller of
+    // index_block_bytes() would race with lines still being indexed under
+    // the old one; an older snapshot does not reset it again
+    if (indexReset && config.indexGeneration_ > m_indexGeneration_.load(std::memory_order_relaxed)) {
+        close_index_blocks();
+        m_indexGeneration_.store(config.indexGeneration_, std::memory_order_relaxed);
+    }
+
+    if (config.fileBufferBytes_ != 0) {
+        // Counted as written, and errors counted, when the buffer is flushed
+        FileBuffer &buffer = m_fileBuffers_[path];
+        buffer.data_.append(line);
+        ++buffer.lines_;
+        if (indexBlockBytes != 0) {
+            index_line(path, msg, line.size(), buffer.data_.size(), indexBlockBytes);
         }
-        return;
+        if (buffer.data_.size() >= config.fileBufferBytes_) {
+            flush_file_buffer(path, buffer, counters);
+        }
+        return true;
     }
 
-    s_init = true;
-    ec.clear();
+    std::error_code ec;
+    std::size_t writeCalls = 0;
+    const auto t0 = clock::now();
+    const bool ok = platform::append_to_file(path, line, ec, &writeCalls);
+    StatsCounters::add(counters.file_.writeNs_, steady_ns(clock::now()) - steady_ns(t0));
+    StatsCounters::add(counters.file_.writeCalls_, writeCalls);
+    if (ok) {
+        StatsCounters::add(counters.file_.messages_, 1);
+        StatsCounters::add(counters.file_.bytes_, line.size());
+    } else {
+        StatsCounters::add(counters.file_.errors_, 1);
+    }
+    if (indexBlockBytes != 0) {
+        // A failed write may have left part of the line, which breaks the
+        // offsets: the file is then picked up again from its current size
+        if (ok) {
+            index_line(path, msg, line.size(), 0, indexBlockBytes);
+        } else {
+            drop_index(path);
+        }
+    }
+    return ok;
 }
 
-Handler::~Handler()
+bool Handler::flush_file_buffer(const std::string &path, FileBuffer &buffer, StatsCounters &counters)
 {
-    std::lock_guard<std::mutex> lg(s_mutex);
-    s_init = false;
+    using clock = std::chrono::steady_clock;
+
+    if (buffer.data_.empty()) {
+        return true;
+    }
+    std::error_code ec;
+    std::size_t writeCalls = 0;
+    const auto t0 = clock::now();
+    const bool ok = platform::append_to_file(path, buffer.data_, ec, &writeCalls);
+    StatsCounters::add(counters.file_.writeNs_, steady_ns(clock::now()) - steady_ns(t0));
+    StatsCounters::add(counters.file_.writeCalls_, writeCalls);
+    if (ok) {
+        StatsCounters::add(counters.file_.messages_, buffer.lines_);
+        StatsCounters::add(counters.file_.bytes_, buffer.data_.size());
+    } else {
+        StatsCounters::add(counters.file_.errors_, buffer.lines_);
+        StatsCounters::add(counters.dropped_, buffer.lines_);
+        drop_index(path);
+    }
+    buffer.data_.clear();
+    buffer.lines_ = 0;
+    return ok;
 }
 
-void Handler::output_log(const Message &msg, std::ostream &out)
+void Handler::flush_file_buffers(StatsCounters &counters)
 {
-    if (msg.format & (1 << LEVEL_BIT))
-        out << "[" << log_level_to_string(msg.logLevel) << "] ";
-    if (msg.format & (1 << TIMESTAMP_BIT)) {
-        std::string ts;
-        timestamp_to_date_time_string(msg.timestamp, ts);
-        out << ts << " ";
+    {
+        const std::lock_guard<std::mutex> lg(m_fileMutex_);
+        for (auto it = m_fileBuffers_.begin(); it != m_fileBuffers_.end();) {
+            if (it->second.data_.empty()) {
+                // Idle for a whole flush interval, its memory is given back
+                it = m_fileBuffers_.erase(it);
+            } else {
+                flush_file_buffer(it->first, it->second, counters);
+                ++it;
+            }
+        }
     }
-    if (msg.format & (1 << THREAD_ID_BIT)) {
-        out << "thread_id: " << platform::thread_id_to_string(msg.threadId) << " ";
+    m_shards_->flush(counters);
+}
+
+static std::string index_path(const std::string &path)
+{
+    return path + ".idx";
+}
+
+static void append_index_entry(const std::string &path, const LogIndexEntry &entry)
+{
+    std::error_code ec;
+    platform::append_to_file(index_path(path), std::string(reinterpret_cast<const char *>(&entry), sizeof(entry)), ec);
+}
+
+// End of the last block in the index of path and its lastNs_, the index is
+// created if needed
+static std::uint64_t indexed_end(const std::string &path, std::uint64_t &lastNs)
+{
+    lastNs = 0;
+    const std::string idx = index_path(path);
+    std::size_t size = 0;
+    std::error_code ec;
+    if (!platform::file_size(idx, size, ec) || size < 16) {
+        std::string header(kLogIndexMagic, sizeof(kLogIndexMagic));
+        const std::uint32_t fields[2] = {kLogIndexVersion, static_cast<std::uint32_t>(sizeof(LogIndexEntry))};
+        header.append(reinterpret_cast<const char *>(fields), sizeof(fields));
+        platform::append_to_file(idx, header, ec);
+        return 0;
+    }
+    if (size < 16 + sizeof(LogIndexEntry)) {
+        return 0;
     }
-    out << msg.message;
+    const void *map = platform::map_file_readonly(idx, size, ec);
+    if (map == nullptr) {
+        return 0;
+    }
+    LogIndexEntry last;
+    const std::size_t count = (size - 16) / sizeof(LogIndexEntry);
+    std::memcpy(&last, static_cast<const char *>(map) + 16 + (count - 1) * sizeof(LogIndexEntry), sizeof(last));
+    platform::unmap_file(map, size);
+    lastNs = last.lastNs_;
+    return last.offset_ + last.size_;
 }
 
-void Handler::process()
+// Appends the block, its lastNs_ raised to that of the entries before it
+static void append_index_block(const std::string &path, LogIndexEntry block, std::uint64_t &lastNs)
 {
-    m_queuePtr->wait_wail_empty_for(1);
+    block.lastNs_ = std::max(block.lastNs_, lastNs);
+    lastNs = block.lastNs_;
+    append_index_entry(path, block);
+}
 
-    auto msgOpt = m_queuePtr->pop();
-    if (!msgOpt.has_value()) {
-        return;
+void Handler::drop_index(const std::string &path)
+{
+    m_indexes_.erase(path);
+}
+
+void Handler::index_line(const std::string &path, const Message &msg, std::size_t size, std::size_t buffered,
+    std::size_t blockBytes)
+{
+    auto it = m_indexes_.find(path);
+    if (it == m_indexes_.end()) {
+        std::size_t fileSize = 0;
+        std::error_code ec;
+        platform::file_size(path, fileSize, ec);
+        fileSize += buffered;
+        const std::uint64_t lineStart = fileSize >= size ? fileSize - size : 0;
+        std::uint64_t lastNs = 0;
+        const std::uint64_t indexed = indexed_end(path, lastNs);
+        if (indexed < lineStart) {
+            // Bytes written without an index: a block that matches every
+            // level and, as its lines were all logged by now, any earlier time
+            const LogIndexEntry gap = {indexed, lineStart - indexed, 0, system_ns(), 0, 0xf};
+            append_index_block(path, gap, lastNs);
+        }
+        FileIndex index = {};
+        index.end_ = lineStart;
+        index.lastNs_ = lastNs;
+        index.block_.offset_ = lineStart;
+        it = m_indexes_.emplace(path, index).first;
+    }
+
+    FileIndex &index = it->second;
+    LogIndexEntry &block = index.block_;
+    if (block.lines_ == 0) {
+        block.firstNs_ = msg.timestampNs_;
+        block.lastNs_ = msg.timestampNs_;
+    } else {
+        block.firstNs_ = std::min<std::uint64_t>(block.firstNs_, msg.timestampNs_);
+        block.lastNs_ = std::max<std::uint64_t>(block.lastNs_, msg.timestampNs_);
+    }
+    block.size_ += size;
+    block.lines_ += 1;
+    block.levels_ |= 1u << msg.logLevel_;
+    index.end_ += size;
+
+    if (block.size_ >= blockBytes) {
+        append_index_block(path, block, index.lastNs_);
+        block = LogIndexEntry{index.end_, 0, 0, 0, 0, 0};
+    }
+}
+
+void Handler::close_index_blocks()
+{
+    for (auto &entry : m_indexes_) {
+        if (entry.second.block_.size_ != 0) {
+            append_index_block(entry.first, entry.second.block_, entry.second.lastNs_);
+        }
     }
-    const Message &msg = *msgOpt;
+    m_indexes_.clear();
+}
+
+bool Handler::write_to_stream(const std::string &line, StatsCounters &counters)
+{
+    using clock = std::chrono::steady_clock;
+
+    const auto t0 = clock::now();
+    m_stream_.write(line.data(), static_cast<std::streamsize>(line.size()));
+    StatsCounters::add(counters.stream_.writeNs_, steady_ns(clock::now()) - steady_ns(t0));
+    StatsCounters::add(counters.stream_.writeCalls_, 1);
+    if (m_stream_) {
+        StatsCounters::add(counters.stream_.messages_, 1);
+        StatsCounters::add(counters.stream_.bytes_, line.size());
+        return true;
+    }
+    StatsCounters::add(counters.stream_.errors_, 1);
+    m_stream_.clear();
+    return false;
+}
+
+void Handler::write_repeats(const HandlerConfig &config, DedupRun &run, const std::string *path, ThreadState &state)
+{
+    Message &msg = run.last_;
+    const auto now = std::chrono::system_clock::now();
+    msg.timestamp_ = std::chrono::system_clock::to_time_t(now);
+    msg.timestampNs_ = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count());
+    msg.message_.assign("last message repeated ");
+    text::append_value(msg.message_, run.repeats_);
+    msg.message_.append(run.repeats_ == 1 ? " time\n" : " times\n");
+
+    std::string line;
+    output_log(msg, config.outputFormat_, line);
+    if (path != nullptr) {
+        write_to_file(config, msg, *path, line, state);
+    } else {
+        write_to_stream(line, state.counters_);
+    }
+    run.repeats_ = 0;
+    --state.pendingRuns_;
+}
+
+bool Handler::is_repeat(DedupRun &run, const std::string *path, const Message &msg, std::uint64_t hash,
+    std::int64_t now, const HandlerConfig &config, ThreadState &state)
+{
+    if (run.start_ != 0 && run.hash_ == hash && now - run.start_ < config.dedupWindow_.count()) {
+        if (run.repeats_++ == 0) {
+            ++state.pendingRuns_;
+            run.last_.logLevel_ = msg.logLevel_;
+            run.last_.threadId_ = msg.threadId_;
+            run.last_.format_ = msg.format_;
+        }
+        return true;
+    }
+    if (run.repeats_ != 0) {
+        write_repeats(config, run, path, state);
+    }
+    run.hash_ = hash;
+    run.start_ = now;
+    return false;
+}
+
+void Handler::flush_repeats(const HandlerConfig &config, ThreadState &state, bool all)
+{
+    const std::int64_t now = steady_ns(std::chrono::steady_clock::now());
+    const auto expired = [&config, now, all](const DedupRun &run) {
+        return run.repeats_ != 0 && (all || now - run.start_ >= config.dedupWindow_.count());
+    };
+    for (auto &entry : state.fileRuns_) {
+        if (expired(entry.second)) {
+            write_repeats(config, entry.second, &entry.first, state);
+            entry.second.start_ = 0;
+        }
+    }
+    if (expired(state.streamRun_)) {
+        write_repeats(config, state.streamRun_, nullptr, state);
+        state.streamRun_.start_ = 0;
+    }
+}
 
-    if (msg.logLevel > max_level() || msg.flags == FLAGS_OUTPUT_TO_NOWHERE)
+bool Handler::is_filtered(const HandlerConfig &config, const Message &msg)
+{
+    return msg.flags_ == FLAGS_OUTPUT_TO_NOWHERE
+        || (!msg.replayed_ && !msg.forced_ && msg.logLevel_ > config.level_for(msg.category_.empty() ? msg.filename_ : msg.category_));
+}
+
+void Handler::write_message(const HandlerConfig &config, const Message &msg, ThreadState &state)
+{
+    if (is_filtered(config, msg)) {
+        StatsCounters::add(state.counters_.filtered_, 1);
         return;
+    }
+    emit_message(config, msg, nullptr, state);
+}
 
-    if (msg.flags & (1 << OUTPUT_TO_FILE_BIT)) {
-        std::error_code ec;
-        const std::string filePath = m_root + "/" + msg.filename;
-        const std::string line = [&msg]() {
-            std::ostringstream oss;
-            output_log(msg, oss);
-            return oss.str();
-        }();
+void Handler::emit_message(const HandlerConfig &config, const Message &msg, const std::string *rendered,
+    ThreadState &state)
+{
+    StatsCounters &counters = state.counters_;
+    bool toFile = (msg.flags_ & (1 << OUTPUT_TO_FILE_BIT)) != 0;
+    bool toStream = (msg.flags_ & (1 << OUTPUT_TO_STREAM_BIT)) != 0;
+    thread_local std::string filePath;
+    filePath.clear();
+    if (toFile) {
+        filePath.append(config.root_).append("/");
+        if (config.threadShards_ && !config.collector_) {
+            append_shard_path(filePath, msg.filename_, platform::thread_id_to_string(msg.threadId_));
+        } else {
+            filePath.append(msg.filename_);
+        }
+    }
+
+    if (config.dedupWindow_.count() > 0) {
+        const std::uint64_t hash = message_hash(msg);
+        const std::int64_t now = steady_ns(std::chrono::steady_clock::now());
+        if (toFile) {
+            auto it = state.fileRuns_.find(filePath);
+            if (it == state.fileRuns_.end()) {
+                it = state.fileRuns_.emplace(filePath, DedupRun{}).first;
+                it->second.last_.filename_ = msg.filename_;
+            }
+            toFile = !is_repeat(it->second, &it->first, msg, hash, now, config, state);
+        }
+        if (toStream) {
+            toStream = !is_repeat(state.streamRun_, nullptr, msg, hash, now, config, state);
+        }
+        if (!toFile && !toStream) {
+            StatsCounters::add(counters.deduplicated_, 1);
+            return;
+        }
+    }
+
+    thread_local std::string line;
+    if (rendered == nullptr) {
+        line.clear();
+        output_log(msg, config.outputFormat_, line);
+        rendered = &line;
+    }
+    bool written = true;
+
+    if (toFile && !write_to_file(config, msg, filePath, *rendered, state)) {
+        written = false;
+    }
+    if (toStream && !write_to_stream(*rendered, counters)) {
+        written = false;
+    }
+
+    StatsCounters::add(counters.processed_, 1);
+    if (!written) {
+        StatsCounters::add(counters.dropped_, 1);
+    }
+    const std::uint64_t now = system_ns();
+    counters.add_latency(now > msg.timestampNs_ ? now - msg.timestampNs_ : 0);
+}
+
+void Handler::process()
+{
+    // Wake up at least in time for the next timer
+    std::chrono::nanoseconds timeout = kMaxWait;
+    const std::int64_t nextTimer = m_nextTimer_.load(std::memory_order_relaxed);
+    if (nextTimer != INT64_MAX) {
+        const std::int64_t left = nextTimer - steady_ns(std::chrono::steady_clock::now());
+        timeout = std::min(timeout, std::chrono::nanoseconds(left > 0 ? left : 0));
+    }
+    // While batches are being rendered the queue is only polled, the
+    // writes of the rendered ones must not wait for new messages
+    const bool pipelined = m_formatterCount_.load(std::memory_order_relaxed) != 0
+        || m_jobCount_.load(std::memory_order_relaxed) != 0;
+    if (m_jobCount_.load(std::memory_order_relaxed) == 0) {
+        m_queuePtr_->wait_wail_empty_for(timeout);
+    }
+
+    ThreadState &state = this_thread_state();
+    // Announce the epoch before loading the snapshot, so that
+    // reclaim_configs() does not free the snapshot while it is used
+    state.configEpoch_.store(m_configEpoch_.load());
+    const HandlerConfig &config = *m_config_.load();
+
+    thread_local std::vector<Message> batch;
+    if (config.orderedUrgent_) {
+        m_queuePtr_->pop_batch_ordered(batch, kBatchSize,
+            [&config](const Message &older, const Message &urgent) {
+                // A shard holds the messages of one thread
+                return older.filename_ == urgent.filename_
+                    && (!config.threadShards_ || older.threadId_ == urgent.threadId_);
+            });
+    } else {
+        m_queuePtr_->pop_batch(batch, kBatchSize);
+    }
+    if (pipelined) {
+        const bool submitted = !batch.empty();
+        if (submitted) {
+            submit_job(batch);
+        }
+        // Keep the formatters busy, but write at least one job when the
+        // queue has nothing new
+        const std::size_t jobs = m_jobCount_.load(std::memory_order_relaxed);
+        const std::size_t maxJobs = 2 * m_formatterCount_.load(std::memory_order_relaxed) + 1;
+        write_jobs(config, state, submitted ? std::min(jobs, maxJobs) : (jobs == 0 ? 0 : jobs - 1));
+    } else {
+        for (const Message &msg : batch) {
+            write_message(config, msg, state);
+        }
+    }
+    batch.clear();
+    if (state.pendingRuns_ != 0) {
+        flush_repeats(config, state, config.dedupWindow_.count() <= 0);
+    }
+    if (config.fileBufferBytes_ != 0 && config.fileFlushDelay_.count() <= 0) {
+        flush_file_buffers(state.counters_);
+    }
+    if (config.collector_) {
+        config.collector_->send(state.collectorBatch_, state.collectorFrames_, state.counters_);
+        state.collectorFrames_ = 0;
+    }
+    if (steady_ns(std::chrono::steady_clock::now()) >= m_nextTimer_.load(std::memory_order_relaxed)) {
+        run_timers(config, state);
+    }
+    state.configEpoch_.store(UINT64_MAX);
+}
+
+void Handler::formatter_threads(std::size_t count)
+{
+    const std::lock_guard<std::mutex> control(m_formatterControlMutex_);
+    // The running formatters render the jobs left before they exit
+    std::vector<std::thread> running;
+    {
+        const std::lock_guard<std::mutex> lg(m_poolMutex_);
+        m_stopFormatters_ = true;
+        running.swap(m_formatters_);
+        m_formatterCount_ = 0;
+    }
+    m_jobCv_.notify_all();
+    for (std::thread &formatter : running) {
+        formatter.join();
+    }
 
-        platform::append_to_file(filePath, line, ec);
+    const std::lock_guard<std::mutex> lg(m_poolMutex_);
+    m_stopFormatters_ = false;
+    for (std::size_t i = 0; i < count; ++i) {
+        m_formatters_.emplace_back(&Handler::run_formatter, this);
+    }
+    m_formatterCount_ = count;
+}
+
+std::size_t Handler::formatter_threads() const
+{
+    return m_formatterCount_.load();
+}
+
+void Handler::submit_job(std::vector<Message> &batch)
+{
+    std::unique_ptr<FormatJob> job;
+    {
+        const std::lock_guard<std::mutex> lg(m_poolMutex_);
+        if (!m_freeJobs_.empty()) {
+            job = std::move(m_freeJobs_.back());
+            m_freeJobs_.pop_back();
+        }
+    }
+    if (!job) {
+        job = std::make_unique<FormatJob>();
     }
-    if (msg.flags & (1 << OUTPUT_TO_STREAM_BIT)) {
-        output_log(msg, m_stream);
+    // Swapped, so that both vectors keep their capacity
+    job->messages_.swap(batch);
+    job->claimed_ = false;
+    job->done_ = false;
+    {
+        const std::lock_guard<std::mutex> lg(m_poolMutex_);
+        m_jobs_.push_back(std::move(job));
+        m_jobCount_ = m_jobs_.size();
     }
+    m_jobCv_.notify_one();
+}
+
+void Handler::write_jobs(const HandlerConfig &config, ThreadState &state, std::size_t keep)
+{
+    std::unique_lock<std::mutex> lock(m_poolMutex_);
+    while (!m_jobs_.empty()) {
+        if (!m_jobs_.front()->done_) {
+            if (m_jobs_.size() <= keep) {
+                break;
+            }
+            // Without formatter threads the jobs left are rendered here
+            FormatJob *job = m_formatters_.empty() ? claim_job() : nullptr;
+            if (job != nullptr) {
+                lock.unlock();
+                format_job(config, *job, state.counters_);
+                lock.lock();
+                job->done_ = true;
+            } else {
+                m_doneCv_.wait(lock);
+            }
+            continue;
+        }
+
+        std::unique_ptr<FormatJob> job = std::move(m_jobs_.front());
+        m_jobs_.pop_front();
+        m_jobCount_ = m_jobs_.size();
+        lock.unlock();
+        for (std::size_t i = 0; i < job->messages_.size(); ++i) {
+            if (!job->filtered_[i]) {
+                emit_message(config, job->messages_[i], &job->lines_[i], state);
+            }
+        }
+        job->messages_.clear();
+        lock.lock();
+        m_freeJobs_.push_back(std::move(job));
+    }
+}
+
+Handler::FormatJob *Handler::claim_job()
+{
+    for (const std::unique_ptr<FormatJob> &job : m_jobs_) {
+        if (!job->claimed_) {
+            job->claimed_ = true;
+            return job.get();
+        }
+    }
+    return nullptr;
+}
+
+void Handler::format_job(const HandlerConfig &config, FormatJob &job, StatsCounters &counters)
+{
+    const std::size_t count = job.messages_.size();
+    if (job.lines_.size() < count) {
+        job.lines_.resize(count);
+    }
+    job.filtered_.assign(count, 0);
+    for (std::size_t i = 0; i < count; ++i) {
+        const Message &msg = job.messages_[i];
+        if (is_filtered(config, msg)) {
+            job.filtered_[i] = 1;
+            StatsCounters::add(counters.filtered_, 1);
+            continue;
+        }
+        job.lines_[i].clear();
+        output_log(msg, config.outputFormat_, job.lines_[i]);
+    }
+}
+
+void Handler::run_formatter()
+{
+    ThreadState &state = this_thread_state();
+    std::unique_lock<std::mutex> lock(m_poolMutex_);
+    while (true) {
+        FormatJob *job = claim_job();
+        if (job == nullptr) {
+            if (m_stopFormatters_) {
+                break;
+            }
+            m_jobCv_.wait(lock);
+            continue;
+        }
+        lock.unlock();
+        state.configEpoch_.store(m_configEpoch_.load());
+        format_job(*m_config_.load(), *job, state.counters_);
+        state.configEpoch_.store(UINT64_MAX);
+        lock.lock();
+        job->done_ = true;
+        m_doneCv_.notify_all();
+    }
+}
+
+void Handler::schedule(timer_id_t id, std::chrono::nanoseconds interval, timer_fn_t run)
+{
+    const std::lock_guard<std::mutex> lg(m_timerMutex_);
+    m_timers_.erase(std::remove_if(m_timers_.begin(), m_timers_.end(),
+        [id](const Timer &timer) { return timer.id_ == id; }), m_timers_.end());
+    if (interval.count() > 0) {
+        const std::int64_t next = steady_ns(std::chrono::steady_clock::now()) + interval.count();
+        m_timers_.push_back(Timer{id, interval, next, std::move(run)});
+    }
+
+    std::int64_t earliest = INT64_MAX;
+    for (const Timer &timer : m_timers_) {
+        earliest = std::min(earliest, timer.next_);
+    }
+    m_nextTimer_ = earliest;
+}
+
+void Handler::run_timers(const HandlerConfig &config, ThreadState &state)
+{
+    // Due callbacks are copied out and run without holding m_timerMutex_
+    std::vector<timer_fn_t> due;
+    {
+        const std::lock_guard<std::mutex> lg(m_timerMutex_);
+        const std::int64_t now = steady_ns(std::chrono::steady_clock::now());
+        std::int64_t earliest = INT64_MAX;
+        for (Timer &timer : m_timers_) {
+            if (now >= timer.next_) {
+                due.push_back(timer.run_);
+                timer.next_ = now + timer.interval_.count();
+            }
+            earliest = std::min(earliest, timer.next_);
+        }
+        m_nextTimer_ = earliest;
+    }
+    for (const timer_fn_t &run : due) {
+        run(config, state);
+    }
+}
+
+HandlerStats Handler::stats()
+{
+    HandlerStats result;
+    result.queueDepth_ = m_queuePtr_->size();
+    result.peakQueueDepth_ = m_queuePtr_->peak_size();
+
+    const std::lock_guard<std::mutex> lg(m_statsMutex_);
+    for (const auto &entry : m_threads_) {
+        entry.second->counters_.add_to(result);
+    }
+    return result;
+}
+
+void Handler::stats_to_file(const char *filename, std::chrono::milliseconds interval)
+{
+    if (filename == nullptr || *filename == '\0') {
+        interval = std::chrono::milliseconds(0);
+    }
+    schedule(TIMER_STATS_FILE, interval,
+        [this, path = std::string(filename == nullptr ? "" : filename)](const HandlerConfig &config, ThreadState &) {
+            std::string line;
+            timestamp_to_date_time_string(timestamp(), line);
+            append_stats(line, stats());
+
+            std::error_code ec;
+            platform::append_to_file(config.root_ + "/" + path, line, ec);
+        });
+}
+
+void Handler::sampling_report(const char *filename, flags_t flags, std::chrono::milliseconds interval)
+{
+    if (filename == nullptr) {
+        filename = "";
+    }
+    schedule(TIMER_SAMPLING_REPORT, interval,
+        [this, path = std::string(filename), flags](const HandlerConfig &config, ThreadState &state) {
+            write_sampling_report(config, state, path, flags);
+        });
+}
+
+void Handler::make_default(const char *filename, flags_t flags, line_format_t format)
+{
+    DefaultTarget &target = default_target();
+    const std::lock_guard<std::mutex> lg(target.mutex_);
+    target.handler_ = this;
+    target.filename_ = filename == nullptr ? "" : filename;
+    target.flags_ = flags;
+    target.format_ = format;
+    s_defaultGeneration.fetch_add(1, std::memory_order_release);
+}
+
+void Handler::metrics_report(const char *filename, flags_t flags, std::chrono::milliseconds interval)
+{
+    if (filename == nullptr) {
+        filename = "";
+    }
+    // Start of the interval being aggregated, steady clock ns
+    auto start = std::make_shared<std::atomic<std::int64_t>>(steady_ns(std::chrono::steady_clock::now()));
+    schedule(TIMER_METRICS_REPORT, interval,
+        [this, start, path = std::string(filename), flags](const HandlerConfig &config, ThreadState &state) {
+            const std::int64_t now = steady_ns(std::chrono::steady_clock::now());
+            const std::int64_t elapsed = now - start->exchange(now);
+            write_metrics_report(config, state, path, flags, static_cast<double>(elapsed) / 1e9);
+        });
+}
+
+void Handler::call_site_control(const char *path, std::chrono::milliseconds interval)
+{
+    if (path == nullptr || *path == '\0') {
+        interval = std::chrono::milliseconds(0);
+    }
+    // Content applied last; the rules stay as they are until it changes
+    struct Control {
+        std::mutex mutex_;
+        std::string applied_;
+    };
+    auto control = std::make_shared<Control>();
+    schedule(TIMER_CALL_SITE_CONTROL, interval,
+        [control, path = std::string(path == nullptr ? "" : path)](const HandlerConfig &, ThreadState &) {
+            std::string content;
+            std::size_t size = 0;
+            std::error_code ec;
+            if (platform::file_size(path, size, ec) && size != 0) {
+                const void *data = platform::map_file_readonly(path, size, ec);
+                if (data == nullptr) {
+                    return;
+                }
+                content.assign(static_cast<const char *>(data), size);
+                platform::unmap_file(data, size);
+            }
+
+            const std::lock_guard<std::mutex> lg(control->mutex_);
+            if (content != control->applied_ && apply_call_site_rules(content)) {
+                control->applied_ = std::move(content);
+            }
+        });
+}
+
+void Handler::fill_report_message(log_level_t level, const std::string &filename, flags_t flags, Message &msg)
+{
+    const auto now = std::chrono::system_clock::now();
+    msg.logLevel_ = level;
+    msg.threadId_ = std::this_thread::get_id();
+    msg.filename_ = filename;
+    msg.format_ = LINE_FORMAT_ALL;
+    msg.flags_ = flags;
+    msg.timestamp_ = std::chrono::system_clock::to_time_t(now);
+    msg.timestampNs_ = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
+}
+
+void Handler::write_metrics_report(const HandlerConfig &config, ThreadState &state,
+    const std::string &filename, flags_t flags, double seconds)
+{
+    for_each_metric([&](Metric &metric) {
+        Message msg;
+        if (!metric.take_summary(msg.fields_, seconds)) {
+            return;
+        }
+        fill_report_message(INFO, filename, flags, msg);
+        msg.message_.append("metric ").append(metric.name()).append("\n");
+        write_message(config, msg, state);
+    });
+}
+
+void Handler::write_sampling_report(const HandlerConfig &config, ThreadState &state,
+    const std::string &filename, flags_t flags)
+{
+    for (SampledSite *site = sampled_sites(); site != nullptr; site = site->next_) {
+        const std::uint64_t suppressed = site->suppressed_.load(std::memory_order_relaxed);
+        const std::uint64_t reported = site->reported_.exchange(suppressed, std::memory_order_relaxed);
+        if (suppressed <= reported) {
+            continue;
+        }
+
+        Message msg;
+        fill_report_message(WARNING, filename, flags, msg);
+        msg.message_.append(site->file_);
+        msg.message_.push_back(':');
+        text::append_value(msg.message_, site->line_);
+        msg.message_.append(" suppressed ");
+        text::append_value(msg.message_, suppressed - reported);
+        msg.message_.append(" messages\n");
+        write_message(config, msg, state);
+    }
+}
+
+log_level_t HandlerConfig::level_for(std::string_view category) const
+{
+    if (categoryLevels_.empty()) {
+        return maxLevel_;
+    }
+    for (;;) {
+        const auto it = categoryLevels_.find(category);
+        if (it != categoryLevels_.end()) {
+            return it->second;
+        }
+        const std::size_t pos = category.find_last_of("./");
+        if (pos == std::string_view::npos) {
+            return maxLevel_;
+        }
+        category = category.substr(0, pos);
+    }
+}
+
+template<typename F>
+void Handler::update_config(F &&change)
+{
+    // Called with m_configMutex_ held
+    auto next = std::make_unique<HandlerConfig>(*m_configOwner_);
+    change(*next);
+    m_config_.store(next.get());
+    const std::uint64_t epoch = m_configEpoch_.fetch_add(1) + 1;
+    m_retiredConfigs_.emplace_back(epoch, std::move(m_configOwner_));
+    m_configOwner_ = std::move(next);
+    reclaim_configs();
+}
+
+void Handler::reclaim_configs()
+{
+    std::uint64_t oldest = UINT64_MAX;
+    {
+        const std::lock_guard<std::mutex> lg(m_statsMutex_);
+        for (const auto &entry : m_threads_) {
+            oldest = std::min(oldest, entry.second->configEpoch_.load());
+        }
+    }
+    // A thread that announced epoch E loaded the snapshot published at E or later
+    m_retiredConfigs_.erase(
+        std::remove_if(m_retiredConfigs_.begin(), m_retiredConfigs_.end(),
+            [oldest](const auto &entry) { return entry.first <= oldest; }),
+        m_retiredConfigs_.end());
 }
 
 void Handler::root(std::string rootValue, std::error_code &ec)
 {
-    const std::lock_guard<std::mutex> lg(s_mutex);
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
     if (!platform::create_directories(rootValue, ec) || !platform::is_directory(rootValue, ec)) {
         if (!ec) {
             ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_NOT_DIRECTORY);
@@ -243,26 +1521,158 @@ void Handler::root(std::string rootValue, std::error_code &ec)
         return;
     }
 
-    m_root = std::move(rootValue);
+    update_config([&rootValue](HandlerConfig &config) { config.root_ = std::move(rootValue); });
     ec.clear();
 }
 
 std::string Handler::root() const
 {
-    const std::lock_guard<std::mutex> lg(s_mutex);
-    return m_root;
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->root_;
 }
 
 void Handler::max_level(log_level_t level)
 {
-    const std::lock_guard<std::mutex> lg(s_mutex);
-    m_maxLevel = level;
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([level](HandlerConfig &config) { config.maxLevel_ = level; });
 }
 
 log_level_t Handler::max_level() const
 {
-    const std::lock_guard<std::mutex> lg(s_mutex);
-    return m_maxLevel;
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->maxLevel_;
+}
+
+void Handler::category_level(const char *category, log_level_t level)
+{
+    if (category == nullptr) {
+        return;
+    }
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([category, level](HandlerConfig &config) { config.categoryLevels_[category] = level; });
+}
+
+void Handler::clear_category_level(const char *category)
+{
+    if (category == nullptr) {
+        return;
+    }
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([category](HandlerConfig &config) { config.categoryLevels_.erase(std::string(category)); });
+}
+
+void Handler::dedup_window(std::chrono::milliseconds window)
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([window](HandlerConfig &config) { config.dedupWindow_ = window; });
+}
+
+std::chrono::milliseconds Handler::dedup_window() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return std::chrono::duration_cast<std::chrono::milliseconds>(m_configOwner_->dedupWindow_);
+}
+
+void Handler::output_format(output_format_t format)
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([format](HandlerConfig &config) { config.outputFormat_ = format; });
+}
+
+output_format_t Handler::output_format() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->outputFormat_;
+}
+
+void Handler::collector(const char *socketPath)
+{
+    std::shared_ptr<CollectorSink> sink;
+    if (socketPath != nullptr && *socketPath != '\0') {
+        sink = std::make_shared<CollectorSink>(socketPath);
+    }
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([&sink](HandlerConfig &config) { config.collector_ = std::move(sink); });
+}
+
+void Handler::index_block_bytes(std::size_t blockBytes)
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    // Lines written meanwhile are not counted, so every file starts over
+    // from its size when it is indexed again, see write_file_data()
+    update_config([blockBytes](HandlerConfig &config) {
+        config.indexBlockBytes_ = blockBytes;
+        ++config.indexGeneration_;
+    });
+}
+
+std::size_t Handler::index_block_bytes() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->indexBlockBytes_;
+}
+
+void Handler::ordered_urgent(bool ordered)
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    update_config([ordered](HandlerConfig &config) { config.orderedUrgent_ = ordered; });
+}
+
+bool Handler::ordered_urgent() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->orderedUrgent_;
+}
+
+void Handler::thread_shards(bool sharded)
+{
+    {
+        const std::lock_guard<std::mutex> lg(m_configMutex_);
+        update_config([sharded](HandlerConfig &config) { config.threadShards_ = sharded; });
+    }
+    m_shards_->enabled_ = sharded;
+    if (!sharded) {
+        // Records buffered by the threads are not left behind
+        flush();
+    }
+}
+
+bool Handler::thread_shards() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->threadShards_;
+}
+
+void Handler::file_buffer(std::size_t bytes, std::chrono::milliseconds maxDelay)
+{
+    {
+        const std::lock_guard<std::mutex> lg(m_configMutex_);
+        update_config([bytes, maxDelay](HandlerConfig &config) {
+            config.fileBufferBytes_ = bytes;
+            config.fileFlushDelay_ = maxDelay;
+        });
+    }
+    // Lines buffered with the old setting are not left behind
+    flush();
+    schedule(TIMER_FILE_FLUSH, bytes != 0 ? std::chrono::nanoseconds(maxDelay) : std::chrono::nanoseconds(0),
+        [this](const HandlerConfig &, ThreadState &state) { flush_file_buffers(state.counters_); });
+}
+
+std::size_t Handler::file_buffer_bytes() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return m_configOwner_->fileBufferBytes_;
+}
+
+void Handler::flush()
+{
+    flush_file_buffers(this_thread_state().counters_);
+}
+
+HandlerConfig Handler::config() const
+{
+    const std::lock_guard<std::mutex> lg(m_configMutex_);
+    return *m_configOwner_;
 }
 
 } // namespace tslogger
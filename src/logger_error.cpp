@@ -23,6 +23,10 @@ std::string TsLoggerErrorCategory::message(int ev) const
             return "The single-instance object already exists";
         case TsLoggerStatus::TS_LOGGER_ERR_NOT_DIRECTORY:
             return "This should be a directory";
+        case TsLoggerStatus::TS_LOGGER_ERR_BAD_RING:
+            return "The file is not a valid log ring or the capacity is not supported";
+        case TsLoggerStatus::TS_LOGGER_ERR_BAD_SHARD:
+            return "The file is not a valid log shard";
     }
     return "Unknown error";
 }
@@ -0,0 +1,124 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+#include "fields.hpp"
+
+namespace tslogger
+{
+
+namespace
+{
+
+struct Registry {
+    std::mutex mutex_;
+    std::vector<Metric *> metrics_;
+};
+
+// Never destroyed, metrics with static storage may outlive any other static
+Registry &registry()
+{
+    static Registry *s_registry = new Registry();
+    return *s_registry;
+}
+
+constexpr std::size_t kMaxElements = 64;
+
+} // namespace
+
+Metric::Metric(const char *name, metric_type_t type)
+    :
+      m_name_{name == nullptr ? "" : name},
+      m_type_{type}
+{
+    Registry &r = registry();
+    const std::lock_guard<std::mutex> lg(r.mutex_);
+    r.metrics_.push_back(this);
+}
+
+Metric::~Metric()
+{
+    Registry &r = registry();
+    const std::lock_guard<std::mutex> lg(r.mutex_);
+    r.metrics_.erase(std::remove(r.metrics_.begin(), r.metrics_.end(), this), r.metrics_.end());
+}
+
+void for_each_metric(const std::function<void(Metric &metric)> &fn)
+{
+    Registry &r = registry();
+    const std::lock_guard<std::mutex> lg(r.mutex_);
+    for (Metric *metric : r.metrics_) {
+        fn(*metric);
+    }
+}
+
+bool MetricCounter::take_summary(std::string &fields, double seconds)
+{
+    std::uint64_t count = 0;
+    for (Stripe &stripe : m_stripes_) {
+        count += stripe.value_.exchange(0, std::memory_order_relaxed);
+    }
+    if (count == 0) {
+        return false;
+    }
+    text::append_field(fields, "count", count, kMaxElements);
+    const double rate = seconds > 0 ? static_cast<double>(count) / seconds : 0;
+    text::append_field(fields, "per_s", static_cast<std::uint64_t>(rate + 0.5), kMaxElements);
+    return true;
+}
+
+bool MetricGauge::take_summary(std::string &fields, double)
+{
+    if (!m_changed_.exchange(false, std::memory_order_relaxed)) {
+        return false;
+    }
+    text::append_field(fields, "value", value(), kMaxElements);
+    return true;
+}
+
+void MetricHistogram::record(std::uint64_t value)
+{
+    Stripe &stripe = m_stripes_[metric_stripe()];
+    stripe.buckets_[histogram_bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    stripe.sum_.fetch_add(value, std::memory_order_relaxed);
+    std::uint64_t lo = stripe.min_.load(std::memory_order_relaxed);
+    while (value < lo && !stripe.min_.compare_exchange_weak(lo, value, std::memory_order_relaxed)) {
+    }
+    std::uint64_t hi = stripe.max_.load(std::memory_order_relaxed);
+    while (value > hi && !stripe.max_.compare_exchange_weak(hi, value, std::memory_order_relaxed)) {
+    }
+}
+
+bool MetricHistogram::take_summary(std::string &fields, double)
+{
+    // A value recorded during the swap may land in this interval or the
+    // next one with some of its parts, which only blurs the boundary
+    Histogram h;
+    h.min_ = UINT64_MAX;
+    for (Stripe &stripe : m_stripes_) {
+        for (std::size_t i = 0; i < kHistogramBuckets; ++i) {
+            const std::uint64_t n = stripe.buckets_[i].exchange(0, std::memory_order_relaxed);
+            h.buckets_[i] += n;
+            h.count_ += n;
+        }
+        h.sum_ += stripe.sum_.exchange(0, std::memory_order_relaxed);
+        h.min_ = std::min(h.min_, stripe.min_.exchange(UINT64_MAX, std::memory_order_relaxed));
+        h.max_ = std::max(h.max_, stripe.max_.exchange(0, std::memory_order_relaxed));
+    }
+    if (h.count_ == 0) {
+        return false;
+    }
+    text::append_field(fields, "count", h.count_, kMaxElements);
+    text::append_field(fields, "min", h.min_, kMaxElements);
+    text::append_field(fields, "max", h.max_, kMaxElements);
+    text::append_field(fields, "mean", h.sum_ / h.count_, kMaxElements);
+    text::append_field(fields, "p50", h.percentile(50), kMaxElements);
+    text::append_field(fields, "p90", h.percentile(90), kMaxElements);
+    text::append_field(fields, "p99", h.percentile(99), kMaxElements);
+    text::append_field(fields, "p999", h.percentile(99.9), kMaxElements);
+    return true;
+}
+
+} // namespace tslogger
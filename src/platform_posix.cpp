@@ -2,10 +2,14 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <cstring>
 #include <sstream>
 #include <vector>
 
@@ -68,34 +72,202 @@ bool is_directory(const std::string &path, std::error_code &ec)
     return S_ISDIR(st.st_mode);
 }
 
-bool append_to_file(const std::string &path, const std::string &text, std::error_code &ec)
+int open_append(const std::string &path, std::error_code &ec)
 {
-    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
     if (fd == -1) {
         ec = std::error_code(errno, std::generic_category());
-        return false;
+        return -1;
     }
+    ec.clear();
+    return fd;
+}
 
+bool write_all(int fd, const std::string &text, std::error_code &ec, std::size_t *writeCalls)
+{
     ssize_t writtenTotal = 0;
     const ssize_t expected = static_cast<ssize_t>(text.size());
     while (writtenTotal < expected) {
         const ssize_t written = ::write(fd, text.data() + writtenTotal, expected - writtenTotal);
+        if (writeCalls != nullptr) {
+            ++*writeCalls;
+        }
         if (written == -1) {
             if (errno == EINTR) {
                 continue;
             }
             ec = std::error_code(errno, std::generic_category());
-            ::close(fd);
             return false;
         }
         writtenTotal += written;
     }
 
+    ec.clear();
+    return true;
+}
+
+void close_file(int fd)
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
+bool append_to_file(const std::string &path, const std::string &text, std::error_code &ec, std::size_t *writeCalls)
+{
+    const int fd = open_append(path, ec);
+    if (fd == -1) {
+        return false;
+    }
+    const bool ok = write_all(fd, text, ec, writeCalls);
+    ::close(fd);
+    return ok;
+}
+
+void *map_shared_file(const std::string &path, std::size_t &size, std::error_code &ec)
+{
+    const int fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        return nullptr;
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        ::close(fd);
+        return nullptr;
+    }
+    const std::size_t fileSize = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        size = fileSize;
+    } else if (fileSize < size && ::ftruncate(fd, static_cast<off_t>(size)) == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        ::close(fd);
+        return nullptr;
+    }
+    if (size == 0) {
+        ec = std::make_error_code(std::errc::invalid_argument);
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        ec = std::error_code(errno, std::generic_category());
+        return nullptr;
+    }
+
+    ec.clear();
+    return addr;
+}
+
+const void *map_file_readonly(const std::string &path, std::size_t &size, std::error_code &ec)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        return nullptr;
+    }
+
+    struct stat st = {};
+    if (::fstat(fd, &st) == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        ::close(fd);
+        return nullptr;
+    }
+    size = static_cast<std::size_t>(st.st_size);
+    if (size == 0) {
+        ec = std::make_error_code(std::errc::invalid_argument);
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
     ::close(fd);
+    if (addr == MAP_FAILED) {
+        ec = std::error_code(errno, std::generic_category());
+        return nullptr;
+    }
+
+    ec.clear();
+    return addr;
+}
+
+void unmap_file(const void *addr, std::size_t size)
+{
+    if (addr != nullptr) {
+        ::munmap(const_cast<void *>(addr), size);
+    }
+}
+
+bool file_size(const std::string &path, std::size_t &size, std::error_code &ec)
+{
+    struct stat st = {};
+    if (::stat(path.c_str(), &st) == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        return false;
+    }
+    size = static_cast<std::size_t>(st.st_size);
     ec.clear();
     return true;
 }
 
+int connect_unix_socket(const std::string &path, std::error_code &ec)
+{
+    sockaddr_un addr = {};
+    if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+        ec = std::make_error_code(std::errc::invalid_argument);
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        return -1;
+    }
+    // A Unix domain connect() completes at once or fails, EINPROGRESS is not
+    // expected, EAGAIN means the listen backlog is full
+    if (::connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1) {
+        ec = std::error_code(errno, std::generic_category());
+        ::close(fd);
+        return -1;
+    }
+
+    ec.clear();
+    return fd;
+}
+
+long send_nonblocking(int fd, const char *data, std::size_t size, std::error_code &ec)
+{
+    for (;;) {
+        const ssize_t sent = ::send(fd, data, size, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent >= 0) {
+            ec.clear();
+            return static_cast<long>(sent);
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            ec.clear();
+            return 0;
+        }
+        ec = std::error_code(errno, std::generic_category());
+        return -1;
+    }
+}
+
+void close_socket(int fd)
+{
+    if (fd != -1) {
+        ::close(fd);
+    }
+}
+
 bool localtime_safe(std::time_t ts, std::tm &out)
 {
     return ::localtime_r(&ts, &out) != nullptr;
@@ -108,4 +280,9 @@ std::string thread_id_to_string(std::thread::id id)
     return ss.str();
 }
 
+unsigned long process_id()
+{
+    return static_cast<unsigned long>(::getpid());
+}
+
 } // namespace tslogger::platform
@@ -0,0 +1,350 @@
+#include "shm_ring.hpp"
+
+#include "logger.hpp"
+#include "platform.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+namespace tslogger
+{
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+    "the ring is shared between processes and needs address-free atomics");
+
+static constexpr std::uint32_t kRingMagic = 0x52534c54; // "TLSR"
+static constexpr std::uint32_t kRingVersion = 2;
+static constexpr std::size_t kMinCapacity = 4096;
+static constexpr std::size_t kMaxCapacity = std::size_t{1} << 40;
+
+enum : std::uint32_t {
+    RING_EMPTY = 0,
+    RING_INITIALIZING = 1,
+    RING_READY = 2,
+};
+
+// Record word: length in bytes << 2 | state
+enum : std::uint64_t {
+    RECORD_FREE = 0,
+    RECORD_RESERVED = 1,
+    RECORD_COMMITTED = 2,
+    RECORD_PADDING = 3,
+};
+
+struct ShmRingHeader {
+    std::atomic<std::uint32_t> state_;
+    std::uint32_t magic_;
+    std::uint32_t version_;
+    std::uint32_t reserved_;
+    std::uint64_t capacity_;
+    alignas(64) std::atomic<std::uint64_t> head_;
+    alignas(64) std::atomic<std::uint64_t> tail_;
+    alignas(64) std::atomic<std::uint64_t> dropped_;
+};
+
+// Fixed part of a record after its word, followed by the thread id,
+// filename, category, message and fields bytes
+struct RecordFields {
+    std::uint64_t timestampNs_;
+    std::int64_t timestamp_;
+    std::uint32_t messageSize_;
+    std::uint32_t fieldsSize_;
+    std::uint16_t threadIdSize_;
+    std::uint16_t filenameSize_;
+    std::uint16_t categorySize_;
+    std::uint8_t level_;
+    std::uint8_t format_;
+    std::uint8_t flags_;
+    std::uint8_t replayed_;
+    std::uint8_t forced_;
+    std::uint8_t traceEvent_;
+    std::uint8_t reserved_[4];
+};
+
+static constexpr std::size_t kHeaderSize = (sizeof(ShmRingHeader) + 63) & ~std::size_t{63};
+static constexpr std::size_t kRecordPrefix = sizeof(std::uint64_t) + sizeof(RecordFields);
+
+static std::size_t align8(std::size_t n)
+{
+    return (n + 7) & ~std::size_t{7};
+}
+
+static std::size_t round_up_pow2(std::size_t n)
+{
+    std::size_t p = kMinCapacity;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+ShmRing::ShmRing(const char *path, std::size_t capacity, std::error_code &ec)
+    :
+      m_addr_{nullptr},
+      m_size_{0},
+      m_header_{nullptr},
+      m_data_{nullptr},
+      m_capacity_{0}
+{
+    if (path == nullptr) {
+        ec = make_system_error(EFAULT);
+        return;
+    }
+    if (capacity > kMaxCapacity) {
+        ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_RING);
+        return;
+    }
+
+    std::size_t size = capacity == 0 ? 0 : kHeaderSize + round_up_pow2(capacity);
+    void *addr = platform::map_shared_file(path, size, ec);
+    if (addr == nullptr) {
+        return;
+    }
+    m_addr_ = addr;
+    m_size_ = size;
+    m_header_ = static_cast<ShmRingHeader *>(addr);
+    m_data_ = static_cast<unsigned char *>(addr) + kHeaderSize;
+
+    // The first process to open the file initializes the header, the others
+    // wait until it is ready
+    std::uint32_t state = RING_EMPTY;
+    if (capacity != 0 && m_header_->state_.compare_exchange_strong(state, RING_INITIALIZING)) {
+        m_header_->magic_ = kRingMagic;
+        m_header_->version_ = kRingVersion;
+        m_header_->capacity_ = size - kHeaderSize;
+        m_header_->head_.store(0, std::memory_order_relaxed);
+        m_header_->tail_.store(0, std::memory_order_relaxed);
+        m_header_->dropped_.store(0, std::memory_order_relaxed);
+        m_header_->state_.store(RING_READY, std::memory_order_release);
+    }
+    for (int i = 0; m_header_->state_.load(std::memory_order_acquire) != RING_READY; ++i) {
+        if (i == 1000) {
+            ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_RING);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    const std::uint64_t ringCapacity = m_header_->capacity_;
+    if (m_header_->magic_ != kRingMagic || m_header_->version_ != kRingVersion
+        || ringCapacity < kMinCapacity || (ringCapacity & (ringCapacity - 1)) != 0
+        || kHeaderSize + ringCapacity > m_size_) {
+        ec = make_error_code(TsLoggerStatus::TS_LOGGER_ERR_BAD_RING);
+        return;
+    }
+    m_capacity_ = static_cast<std::size_t>(ringCapacity);
+    ec.clear();
+}
+
+ShmRing::~ShmRing()
+{
+    platform::unmap_file(m_addr_, m_size_);
+}
+
+std::atomic<std::uint64_t> &ShmRing::word_at(std::uint64_t position) const
+{
+    return *reinterpret_cast<std::atomic<std::uint64_t> *>(m_data_ + (position & (m_capacity_ - 1)));
+}
+
+void ShmRing::release(std::uint64_t tail, std::uint64_t length)
+{
+    word_at(tail).store(RECORD_FREE, std::memory_order_relaxed);
+    unsigned char *record = reinterpret_cast<unsigned char *>(&word_at(tail));
+    std::memset(record + sizeof(std::uint64_t), 0, length - sizeof(std::uint64_t));
+    m_header_->tail_.store(tail + length, std::memory_order_release);
+}
+
+bool ShmRing::push(const Message &msg)
+{
+    if (m_capacity_ == 0) {
+        return false;
+    }
+
+    char threadId[32];
+    std::size_t threadIdSize = 0;
+    if (msg.format_ & (1 << THREAD_ID_BIT)) {
+        const std::string id = platform::thread_id_to_string(msg.threadId_);
+        threadIdSize = std::min(id.size(), sizeof(threadId));
+        std::memcpy(threadId, id.data(), threadIdSize);
+    }
+    const std::size_t filenameSize = std::min<std::size_t>(msg.filename_.size(), UINT16_MAX);
+    const std::size_t categorySize = std::min<std::size_t>(msg.category_.size(), UINT16_MAX);
+    const std::size_t length = align8(kRecordPrefix + threadIdSize + filenameSize + categorySize + msg.message_.size()
+        + msg.fields_.size());
+    if (length > m_capacity_ / 2) {
+        m_header_->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    // Reserve the record, plus the padding up to the end of the data area if
+    // the record does not fit before it
+    std::uint64_t head = m_header_->head_.load(std::memory_order_relaxed);
+    std::uint64_t padding = 0;
+    for (;;) {
+        const std::uint64_t tail = m_header_->tail_.load(std::memory_order_acquire);
+        const std::uint64_t offset = head & (m_capacity_ - 1);
+        padding = (m_capacity_ - offset < length) ? m_capacity_ - offset : 0;
+        if (head + padding + length - tail > m_capacity_) {
+            m_header_->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (m_header_->head_.compare_exchange_weak(head, head + padding + length,
+                std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (padding != 0) {
+        word_at(head).store(padding << 2 | RECORD_PADDING, std::memory_order_release);
+        head += padding;
+    }
+
+    std::atomic<std::uint64_t> &word = word_at(head);
+    word.store(length << 2 | RECORD_RESERVED, std::memory_order_relaxed);
+
+    RecordFields fields = {};
+    fields.timestampNs_ = msg.timestampNs_;
+    fields.timestamp_ = static_cast<std::int64_t>(msg.timestamp_);
+    fields.messageSize_ = static_cast<std::uint32_t>(msg.message_.size());
+    fields.fieldsSize_ = static_cast<std::uint32_t>(msg.fields_.size());
+    fields.threadIdSize_ = static_cast<std::uint16_t>(threadIdSize);
+    fields.filenameSize_ = static_cast<std::uint16_t>(filenameSize);
+    fields.categorySize_ = static_cast<std::uint16_t>(categorySize);
+    fields.level_ = static_cast<std::uint8_t>(msg.logLevel_);
+    fields.format_ = msg.format_;
+    fields.flags_ = msg.flags_;
+    fields.replayed_ = msg.replayed_ ? 1 : 0;
+    fields.forced_ = msg.forced_ ? 1 : 0;
+    fields.traceEvent_ = msg.traceEvent_ ? 1 : 0;
+
+    unsigned char *out = reinterpret_cast<unsigned char *>(&word) + sizeof(std::uint64_t);
+    std::memcpy(out, &fields, sizeof(fields));
+    out += sizeof(fields);
+    std::memcpy(out, threadId, threadIdSize);
+    out += threadIdSize;
+    std::memcpy(out, msg.filename_.data(), filenameSize);
+    out += filenameSize;
+    std::memcpy(out, msg.category_.data(), categorySize);
+    out += categorySize;
+    std::memcpy(out, msg.message_.data(), msg.message_.size());
+    out += msg.message_.size();
+    std::memcpy(out, msg.fields_.data(), msg.fields_.size());
+
+    word.store(length << 2 | RECORD_COMMITTED, std::memory_order_release);
+    return true;
+}
+
+bool ShmRing::pop(Message &msg)
+{
+    if (m_capacity_ == 0) {
+        return false;
+    }
+
+    for (;;) {
+        const std::uint64_t tail = m_header_->tail_.load(std::memory_order_relaxed);
+        if (tail == m_header_->head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        std::atomic<std::uint64_t> &word = word_at(tail);
+        const std::uint64_t value = word.load(std::memory_order_acquire);
+        const std::uint64_t state = value & 3;
+        const std::uint64_t length = value >> 2;
+        if (state == RECORD_FREE || state == RECORD_RESERVED) {
+            return false;
+        }
+        if (state == RECORD_PADDING) {
+            release(tail, length);
+            continue;
+        }
+
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(&word) + sizeof(std::uint64_t);
+        RecordFields fields;
+        std::memcpy(&fields, in, sizeof(fields));
+        in += sizeof(fields);
+
+        // The producer's thread id cannot be turned back into a
+        // std::thread::id here, so it is rendered into the message instead
+        msg.logLevel_ = static_cast<log_level_t>(fields.level_);
+        msg.format_ = static_cast<line_format_t>(fields.format_ & ~(1 << THREAD_ID_BIT));
+        msg.flags_ = fields.flags_;
+        msg.threadId_ = std::thread::id();
+        msg.timestamp_ = static_cast<time_t>(fields.timestamp_);
+        msg.timestampNs_ = fields.timestampNs_;
+        msg.replayed_ = fields.replayed_ != 0;
+        msg.forced_ = fields.forced_ != 0;
+        msg.traceEvent_ = fields.traceEvent_ != 0;
+        msg.message_.clear();
+        // A trace event is a JSON object, it takes no prefix
+        if ((fields.format_ & (1 << THREAD_ID_BIT)) && !msg.traceEvent_) {
+            msg.message_.append("thread_id: ");
+            msg.message_.append(reinterpret_cast<const char *>(in), fields.threadIdSize_);
+            msg.message_.push_back(' ');
+        }
+        in += fields.threadIdSize_;
+        msg.filename_.assign(reinterpret_cast<const char *>(in), fields.filenameSize_);
+        in += fields.filenameSize_;
+        msg.category_.assign(reinterpret_cast<const char *>(in), fields.categorySize_);
+        in += fields.categorySize_;
+        msg.message_.append(reinterpret_cast<const char *>(in), fields.messageSize_);
+        in += fields.messageSize_;
+        msg.fields_.assign(reinterpret_cast<const char *>(in), fields.fieldsSize_);
+
+        release(tail, length);
+        return true;
+    }
+}
+
+bool ShmRing::skip_reserved()
+{
+    if (m_capacity_ == 0) {
+        return false;
+    }
+
+    const std::uint64_t tail = m_header_->tail_.load(std::memory_order_relaxed);
+    const std::uint64_t head = m_header_->head_.load(std::memory_order_acquire);
+    if (tail == head) {
+        return false;
+    }
+    std::atomic<std::uint64_t> &word = word_at(tail);
+    const std::uint64_t value = word.load(std::memory_order_acquire);
+    if ((value & 3) == RECORD_RESERVED) {
+        release(tail, value >> 2);
+        return true;
+    }
+    if (value != RECORD_FREE) {
+        return false;
+    }
+
+    // The producer moved head_ and died before storing the record word. It
+    // wrote nothing, and a record is written only after its word, so the
+    // bytes up to the next stored word, or up to head_, are all zero
+    std::uint64_t end = tail + sizeof(std::uint64_t);
+    while (end < head && word_at(end).load(std::memory_order_acquire) == RECORD_FREE) {
+        end += sizeof(std::uint64_t);
+    }
+    // The gap may run over the end of the data area, release() does not wrap
+    for (std::uint64_t position = tail; position < end;) {
+        const std::uint64_t length = std::min<std::uint64_t>(end - position, m_capacity_ - (position & (m_capacity_ - 1)));
+        release(position, length);
+        position += length;
+    }
+    return true;
+}
+
+std::size_t ShmRing::pending() const
+{
+    if (m_capacity_ == 0) {
+        return 0;
+    }
+    return static_cast<std::size_t>(m_header_->head_.load(std::memory_order_acquire)
+        - m_header_->tail_.load(std::memory_order_acquire));
+}
+
+std::uint64_t ShmRing::dropped() const
+{
+    return m_capacity_ == 0 ? 0 : m_header_->dropped_.load(std::memory_order_relaxed);
+}
+
+} // namespace tslogger
@@ -0,0 +1,103 @@
+#include "span.hpp"
+
+#include <atomic>
+#include <chrono>
+
+#include "fields.hpp"
+#include "format.hpp"
+#include "json.hpp"
+#include "platform.hpp"
+
+namespace tslogger
+{
+
+static thread_local std::uint32_t s_spanDepth = 0;
+
+// Small thread number for the "tid" of trace events, std::thread::id has
+// no portable numeric form
+static std::uint32_t trace_thread_id()
+{
+    static std::atomic<std::uint32_t> s_nextThread{1};
+    thread_local const std::uint32_t id = s_nextThread.fetch_add(1);
+    return id;
+}
+
+static std::int64_t steady_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Microseconds with three decimals, the unit of trace event times
+static void append_us(std::string &out, std::uint64_t ns)
+{
+    text::append_value(out, ns / 1000);
+    const std::uint64_t fraction = ns % 1000;
+    out.push_back('.');
+    out.push_back(static_cast<char>('0' + fraction / 100));
+    out.push_back(static_cast<char>('0' + fraction / 10 % 10));
+    out.push_back(static_cast<char>('0' + fraction % 10));
+}
+
+Span::Span(Logger &logger, call_site_state_t site, log_level_t level, const char *name)
+    :
+      m_logger_{site == CALL_SITE_DISABLED ? nullptr : &logger},
+      m_name_{name == nullptr ? "" : name},
+      m_level_{level},
+      m_forced_{site == CALL_SITE_ENABLED},
+      m_depth_{0},
+      m_startNs_{0},
+      m_steadyStart_{0}
+{
+    if (m_logger_ == nullptr) {
+        return;
+    }
+    m_depth_ = s_spanDepth++;
+    if (logger.span_format() == SPAN_FORMAT_CHROME_TRACE) {
+        m_startNs_ = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count());
+    }
+    m_steadyStart_ = steady_now_ns();
+}
+
+Span::~Span()
+{
+    if (m_logger_ == nullptr) {
+        return;
+    }
+    const std::int64_t elapsed = steady_now_ns() - m_steadyStart_;
+    const std::uint64_t durationNs = elapsed > 0 ? static_cast<std::uint64_t>(elapsed) : 0;
+    --s_spanDepth;
+
+    Message msg;
+    m_logger_->fill_message_common_parameters(m_level_, msg);
+    msg.forced_ = m_forced_;
+    if (m_logger_->span_format() == SPAN_FORMAT_CHROME_TRACE) {
+        msg.traceEvent_ = true;
+        // The event carries its own tid, no line prefix applies to it
+        msg.format_ = LINE_FORMAT_MSG_ONLY;
+        std::string &out = msg.message_;
+        out.append("{\"name\":");
+        text::append_json_string(out, m_name_);
+        out.append(",\"cat\":");
+        text::append_json_string(out, msg.category_.empty() ? std::string_view("span") : msg.category_);
+        out.append(",\"ph\":\"X\",\"ts\":");
+        append_us(out, m_startNs_);
+        out.append(",\"dur\":");
+        append_us(out, durationNs);
+        out.append(",\"pid\":");
+        text::append_value(out, static_cast<std::uint64_t>(platform::process_id()));
+        out.append(",\"tid\":");
+        text::append_value(out, trace_thread_id());
+        out.append(",\"args\":{\"depth\":");
+        text::append_value(out, m_depth_);
+        out.append("}},\n");
+    } else {
+        msg.message_.append("span ").append(m_name_).append("\n");
+        text::append_field(msg.fields_, "depth", m_depth_, m_logger_->max_elements());
+        text::append_field(msg.fields_, "duration_ns", durationNs, m_logger_->max_elements());
+    }
+    m_logger_->push(std::move(msg));
+}
+
+} // namespace tslogger
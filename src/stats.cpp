@@ -0,0 +1,123 @@
+#include "stats.hpp"
+
+#include "format.hpp"
+
+namespace tslogger
+{
+
+std::size_t histogram_bucket(std::uint64_t value)
+{
+    std::size_t bucket = 0;
+    while (value > 1 && bucket + 1 < kHistogramBuckets) {
+        value >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+std::uint64_t Histogram::percentile(double p) const
+{
+    if (count_ == 0) {
+        return 0;
+    }
+    const std::uint64_t rank = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(count_));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < kHistogramBuckets; ++i) {
+        seen += buckets_[i];
+        if (seen > rank) {
+            const std::uint64_t upper = (std::uint64_t{2} << i) - 1;
+            return upper < max_ ? upper : max_;
+        }
+    }
+    return max_;
+}
+
+void StatsCounters::add_latency(std::uint64_t ns)
+{
+    add(latency_[histogram_bucket(ns)], 1);
+    add(latencySum_, ns);
+    if (ns < latencyMin_.load(std::memory_order_relaxed)) {
+        latencyMin_.store(ns, std::memory_order_relaxed);
+    }
+    if (ns > latencyMax_.load(std::memory_order_relaxed)) {
+        latencyMax_.store(ns, std::memory_order_relaxed);
+    }
+}
+
+static void add_sink(SinkStats &to, const StatsCounters::Sink &from)
+{
+    to.messages_ += from.messages_.load(std::memory_order_relaxed);
+    to.bytes_ += from.bytes_.load(std::memory_order_relaxed);
+    to.writeCalls_ += from.writeCalls_.load(std::memory_order_relaxed);
+    to.writeNs_ += from.writeNs_.load(std::memory_order_relaxed);
+    to.errors_ += from.errors_.load(std::memory_order_relaxed);
+}
+
+void StatsCounters::add_to(HandlerStats &stats) const
+{
+    stats.processed_ += processed_.load(std::memory_order_relaxed);
+    stats.filtered_ += filtered_.load(std::memory_order_relaxed);
+    stats.dropped_ += dropped_.load(std::memory_order_relaxed);
+    stats.deduplicated_ += deduplicated_.load(std::memory_order_relaxed);
+
+    Histogram &h = stats.latencyNs_;
+    std::uint64_t count = 0;
+    for (std::size_t i = 0; i < kHistogramBuckets; ++i) {
+        const std::uint64_t n = latency_[i].load(std::memory_order_relaxed);
+        h.buckets_[i] += n;
+        count += n;
+    }
+    if (count != 0) {
+        const std::uint64_t lo = latencyMin_.load(std::memory_order_relaxed);
+        const std::uint64_t hi = latencyMax_.load(std::memory_order_relaxed);
+        h.min_ = (h.count_ == 0 || lo < h.min_) ? lo : h.min_;
+        h.max_ = hi > h.max_ ? hi : h.max_;
+        h.count_ += count;
+        h.sum_ += latencySum_.load(std::memory_order_relaxed);
+    }
+
+    add_sink(stats.file_, file_);
+    add_sink(stats.stream_, stream_);
+    add_sink(stats.collector_, collector_);
+}
+
+static void append_field(std::string &out, const char *key, std::uint64_t value)
+{
+    if (!out.empty() && out.back() != '\n') {
+        out.push_back(' ');
+    }
+    out.append(key);
+    out.push_back('=');
+    text::append_value(out, value);
+}
+
+static void append_sink(std::string &out, const char *prefix, const SinkStats &sink)
+{
+    const std::string p(prefix);
+    append_field(out, (p + "_messages").c_str(), sink.messages_);
+    append_field(out, (p + "_bytes").c_str(), sink.bytes_);
+    append_field(out, (p + "_writes").c_str(), sink.writeCalls_);
+    append_field(out, (p + "_write_us").c_str(), sink.writeNs_ / 1000);
+    append_field(out, (p + "_errors").c_str(), sink.errors_);
+}
+
+void append_stats(std::string &out, const HandlerStats &stats)
+{
+    append_field(out, "queue_depth", stats.queueDepth_);
+    append_field(out, "peak_queue_depth", stats.peakQueueDepth_);
+    append_field(out, "processed", stats.processed_);
+    append_field(out, "filtered", stats.filtered_);
+    append_field(out, "dropped", stats.dropped_);
+    append_field(out, "deduplicated", stats.deduplicated_);
+    append_field(out, "latency_min_us", stats.latencyNs_.min_ / 1000);
+    append_field(out, "latency_p50_us", stats.latencyNs_.percentile(50) / 1000);
+    append_field(out, "latency_p99_us", stats.latencyNs_.percentile(99) / 1000);
+    append_field(out, "latency_p999_us", stats.latencyNs_.percentile(99.9) / 1000);
+    append_field(out, "latency_max_us", stats.latencyNs_.max_ / 1000);
+    append_sink(out, "file", stats.file_);
+    append_sink(out, "stream", stats.stream_);
+    append_sink(out, "collector", stats.collector_);
+    out.push_back('\n');
+}
+
+} // namespace tslogger
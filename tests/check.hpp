@@ -0,0 +1,27 @@
+#ifndef _TS_LOGGER_TESTS_CHECK_HPP
+#define _TS_LOGGER_TESTS_CHECK_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "platform.hpp"
+
+// Minimal assertion for the test programs: reports the failed condition
+// and fails the test, also in NDEBUG builds
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// Path of a scratch file for a test, unique per process so that tests may
+// run in parallel; the caller removes it
+inline std::string test_path(const char *name)
+{
+    return "/tmp/" + std::string(name) + "." + std::to_string(tslogger::platform::process_id());
+}
+
+#endif // _TS_LOGGER_TESTS_CHECK_HPP
@@ -0,0 +1,41 @@
+#include "call_site.hpp"
+
+#include <cstdio>
+#include <sstream>
+#include <string>
+
+#include "check.hpp"
+#include "logger.hpp"
+
+using namespace tslogger;
+
+// A sampled site disabled by set_call_sites() does not use up its samples:
+// LOG_FIRST_N still passes its first calls once it is enabled again
+int main()
+{
+    const std::string root = test_path("test_call_site");
+    std::stringstream stream;
+    std::error_code ec;
+    Handler handler(root.c_str(), DEBUG, stream, ec);
+    CHECK(!ec);
+    Logger logger(handler.get_queue_ptr(), "call_site.log", FLAGS_OUTPUT_TO_NOWHERE, LINE_FORMAT_ALL);
+
+    auto logFirst = [&logger](int i) { LOG_FIRST_N(logger, INFO, 3, "call %d\n", i); };
+    set_call_sites("test_call_site.cpp", nullptr, CALL_SITE_DISABLED);
+    for (int i = 0; i < 10; ++i) {
+        logFirst(i);
+    }
+    CHECK(handler.get_queue_ptr()->size() == 0);
+
+    reset_call_sites();
+    for (int i = 0; i < 10; ++i) {
+        logFirst(i);
+    }
+    CHECK(handler.get_queue_ptr()->size() == 3);
+
+    while (!handler.get_queue_ptr()->empty()) {
+        handler.process();
+    }
+    std::remove(root.c_str());
+    return 0;
+}
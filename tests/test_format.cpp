@@ -0,0 +1,29 @@
+#include "format.hpp"
+
+#include <string>
+
+#include "check.hpp"
+
+using namespace tslogger;
+
+template<typename T>
+static std::string format(T value)
+{
+    std::string out;
+    text::append_value(out, value);
+    return out;
+}
+
+// Floating values print in the shortest form that round-trips in their own type
+int main()
+{
+    CHECK(format(0.1f) == "0.1");
+    CHECK(format(3.3f) == "3.3");
+    CHECK(format(-1.5f) == "-1.5");
+    CHECK(format(0.1) == "0.1");
+    CHECK(format(1e300) == "1e+300");
+    CHECK(format(0.1L) == "0.1");
+    CHECK(format(42) == "42");
+    CHECK(format(-7L) == "-7");
+    return 0;
+}
@@ -0,0 +1,37 @@
+#include "hexdump.hpp"
+
+#include <array>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+
+using namespace tslogger;
+
+// Overload selection of hexdump(): a typed pointer or a C array given a
+// size dumps that many bytes, a container or a whole array its own size
+int main()
+{
+    std::vector<std::uint8_t> bytes(100);
+    std::vector<char> chars(50);
+    char array[40] = {};
+    std::array<int, 4> ints{};
+    const std::string str("abc");
+    const void *raw = array;
+
+    CHECK(hexdump(bytes.data(), 10).size_ == 10);
+    CHECK(hexdump(chars.data(), 7).size_ == 7);
+    CHECK(hexdump(array, 5).size_ == 5);
+    CHECK(hexdump(array, 5).maxBytes_ == kHexDumpDefaultMaxBytes);
+    CHECK(hexdump(raw, 3).size_ == 3);
+    CHECK(hexdump(array).size_ == sizeof(array));
+    CHECK(hexdump(bytes).size_ == bytes.size());
+    CHECK(hexdump(bytes, 8).maxBytes_ == 8);
+    CHECK(hexdump(ints).size_ == sizeof(int) * ints.size());
+    CHECK(hexdump(str).size_ == str.size());
+
+    std::string out;
+    text::append_hexdump(out, hexdump(bytes.data(), 20));
+    CHECK(out.find("00000010") != std::string::npos);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "log_index.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.hpp"
+#include "logger.hpp"
+
+using namespace tslogger;
+
+namespace
+{
+
+constexpr int kErrors = 20;
+constexpr int kMessages = 400;
+
+std::vector<std::string> read_lines(const std::string &path)
+{
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    for (std::string line; std::getline(in, line);) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+std::vector<std::string> run_query(const LogIndexReader &reader, const LogQuery &query)
+{
+    std::vector<std::string> lines;
+    const std::size_t count = reader.query(query, [&lines](std::string_view line) { lines.emplace_back(line); });
+    CHECK(count == lines.size());
+    return lines;
+}
+
+// JSON lines in blocks of ten, one ns apart and a thousand ns between the
+// blocks; a query from the middle of the third block starts there
+void test_since()
+{
+    const std::string log = test_path("test_log_index_since");
+    std::string data;
+    std::string index(kLogIndexMagic, sizeof(kLogIndexMagic));
+    const std::uint32_t fields[2] = {kLogIndexVersion, static_cast<std::uint32_t>(sizeof(LogIndexEntry))};
+    index.append(reinterpret_cast<const char *>(fields), sizeof(fields));
+    for (std::uint64_t b = 0; b < 4; ++b) {
+        LogIndexEntry entry = {data.size(), 0, (b + 1) * 1000, (b + 1) * 1000 + 9, 10, 1u << INFO};
+        for (std::uint64_t i = 0; i < 10; ++i) {
+            data.append("{\"level\":\"INFO\",\"time_ns\":" + std::to_string(entry.firstNs_ + i) + "}\n");
+        }
+        entry.size_ = data.size() - entry.offset_;
+        index.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+    }
+    std::ofstream(log, std::ios::binary | std::ios::trunc) << data;
+    std::ofstream(log + ".idx", std::ios::binary | std::ios::trunc) << index;
+
+    std::error_code ec;
+    LogIndexReader reader(log.c_str(), ec);
+    CHECK(!ec);
+    LogQuery since;
+    since.fromNs_ = 3005;
+    const std::vector<std::string> lines = run_query(reader, since);
+    CHECK(lines.size() == 15);
+    CHECK(lines.front() == "{\"level\":\"INFO\",\"time_ns\":3005}");
+    CHECK(reader.scanned_bytes() == data.size() / 2);
+
+    std::remove((log + ".idx").c_str());
+    std::remove(log.c_str());
+}
+
+} // namespace
+
+// A Handler writes a log and its index in small blocks, changing the block
+// size halfway, the reader then returns the same lines as a plain read of
+// the log, and a level query skips the blocks without that level
+int main()
+{
+    const std::string root = test_path("test_log_index");
+    const std::string log = root + "/index.log";
+    std::remove((log + ".idx").c_str());
+    std::remove(log.c_str());
+
+    {
+        std::stringstream stream;
+        std::error_code ec;
+        Handler handler(root.c_str(), DEBUG, stream, ec);
+        CHECK(!ec);
+        handler.index_block_bytes(1024);
+        Logger logger(handler.get_queue_ptr(), "index.log", FLAGS_OUTPUT_TO_FILE_ONLY, LINE_FORMAT_ALL);
+        for (int i = 0; i < kErrors; ++i) {
+            LOG(logger, ERROR, "error %d\n", i);
+        }
+        for (int i = 0; i < kMessages; ++i) {
+            LOG(logger, i % 2 == 0 ? INFO : DEBUG, "message %d\n%s", i, i % 50 == 0 ? "continued\n" : "");
+            if (i == kMessages / 2) {
+                // Applied by process() between the queued lines, the open
+                // blocks are closed and the file is picked up from its size
+                handler.process();
+                handler.index_block_bytes(2048);
+            }
+        }
+        while (!handler.get_queue_ptr()->empty()) {
+            handler.process();
+        }
+        handler.flush();
+    }
+
+    const std::vector<std::string> all = read_lines(log);
+    CHECK(all.size() == kErrors + kMessages + kMessages / 50);
+
+    std::error_code ec;
+    LogIndexReader reader(log.c_str(), ec);
+    CHECK(!ec);
+    CHECK(reader.blocks() > 1);
+
+    CHECK(run_query(reader, LogQuery()) == all);
+
+    LogQuery errors;
+    errors.levels_ = 1u << ERROR;
+    const std::vector<std::string> errorLines = run_query(reader, errors);
+    CHECK(errorLines.size() == kErrors);
+    for (int i = 0; i < kErrors; ++i) {
+        CHECK(errorLines[i].rfind("[ERROR]", 0) == 0);
+        const std::string suffix = " error " + std::to_string(i);
+        CHECK(errorLines[i].size() > suffix.size());
+        CHECK(errorLines[i].compare(errorLines[i].size() - suffix.size(), suffix.size(), suffix) == 0);
+    }
+    std::size_t logSize = 0;
+    for (const auto &line : all) {
+        logSize += line.size() + 1;
+    }
+    CHECK(reader.scanned_bytes() < logSize / 2);
+
+    // A continuation line takes the level of its message
+    LogQuery info;
+    info.levels_ = 1u << INFO;
+    const std::vector<std::string> infoLines = run_query(reader, info);
+    CHECK(infoLines.size() == kMessages / 2 + kMessages / 50);
+
+    // Found by binary search, from the first block or past the last one
+    LogQuery since;
+    since.fromNs_ = 1;
+    CHECK(run_query(reader, since) == all);
+    LogQuery future;
+    future.fromNs_ = UINT64_MAX - 1;
+    CHECK(run_query(reader, future).empty());
+
+    std::remove((log + ".idx").c_str());
+    std::remove(log.c_str());
+    std::remove(root.c_str());
+
+    test_since();
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "log_shard.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "logger.hpp"
+
+using namespace tslogger;
+
+namespace
+{
+
+struct Record {
+    std::uint64_t timestampNs;
+    std::string line;
+};
+
+void write_shard(const std::string &path, const std::vector<Record> &records, std::size_t truncate = 0)
+{
+    std::string data;
+    for (const auto &r : records) {
+        append_shard_record(data, r.timestampNs, r.line);
+    }
+    data.resize(data.size() - truncate);
+    std::ofstream(path, std::ios::binary | std::ios::trunc) << data;
+}
+
+std::vector<std::string> merge(const std::vector<std::string> &paths, std::error_code &ec,
+    std::vector<std::string> *failed = nullptr)
+{
+    std::vector<std::string> lines;
+    const std::size_t count = merge_log_shards(
+        paths, [&lines](std::string_view line) { lines.emplace_back(line); }, ec, failed);
+    CHECK(count == lines.size());
+    return lines;
+}
+
+// The shards of three threads interleave back by timestamp; equal
+// timestamps keep the order of the shards, a multi-line record stays whole.
+// A torn or missing shard is reported and the others still merge.
+void test_merge()
+{
+    const std::string a = test_path("test_log_shard_a");
+    const std::string b = test_path("test_log_shard_b");
+    const std::string c = test_path("test_log_shard_c");
+    const std::string missing = test_path("test_log_shard_missing");
+    std::remove(missing.c_str());
+
+    write_shard(a, {{10, "a1\n"}, {30, "a2\n"}, {50, "a3\nmore\n"}, {70, "a4\n"}});
+    write_shard(b, {{20, "b1\n"}, {30, "b2\n"}, {60, "b3\n"}});
+    write_shard(c, {{5, "c1\n"}, {40, "c2\n"}, {80, "c3\n"}});
+
+    std::error_code ec;
+    std::vector<std::string> lines = merge({a, b, c}, ec);
+    CHECK(!ec);
+    const std::vector<std::string> expected{
+        "c1\n", "a1\n", "b1\n", "a2\n", "b2\n", "c2\n", "a3\nmore\n", "b3\n", "a4\n", "c3\n"};
+    CHECK(lines == expected);
+
+    // b loses the tail of its last record, as after a crash
+    write_shard(b, {{20, "b1\n"}, {30, "b2\n"}, {60, "b3\n"}}, 2);
+    std::vector<std::string> failed;
+    lines = merge({a, b, missing, c}, ec, &failed);
+    CHECK(ec);
+    CHECK(failed.size() == 2);
+    CHECK(failed[0] == b || failed[1] == b);
+    CHECK(failed[0] == missing || failed[1] == missing);
+    const std::vector<std::string> salvaged{
+        "c1\n", "a1\n", "b1\n", "a2\n", "b2\n", "c2\n", "a3\nmore\n", "a4\n", "c3\n"};
+    CHECK(lines == salvaged);
+
+    std::remove(a.c_str());
+    std::remove(b.c_str());
+    std::remove(c.c_str());
+}
+
+// Loggers created from the Handler write their lines straight into their
+// own shards: nothing reaches the queue, and the merged shards hold every
+// line with each thread's lines in order
+void test_thread_shards()
+{
+    constexpr int kThreads = 4;
+    constexpr int kLines = 300;
+    const std::string root = test_path("test_log_shard_threads");
+    std::vector<std::string> paths;
+
+    {
+        std::stringstream stream;
+        std::error_code ec;
+        Handler handler(root.c_str(), DEBUG, stream, ec);
+        CHECK(!ec);
+        handler.thread_shards(true);
+        handler.file_buffer(1024, std::chrono::milliseconds(1000));
+
+        std::vector<std::string> threadIds(kThreads);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([&handler, &threadIds, t]() {
+                threadIds[t] = platform::thread_id_to_string(std::this_thread::get_id());
+                Logger logger(handler, "threads.log", FLAGS_OUTPUT_TO_FILE_ONLY, LINE_FORMAT_MSG_ONLY);
+                for (int i = 0; i < kLines; ++i) {
+                    LOG(logger, INFO, "%d %d\n", t, i);
+                }
+            });
+        }
+        for (std::thread &th : threads) {
+            th.join();
+        }
+        CHECK(handler.get_queue_ptr()->empty());
+        handler.flush();
+        CHECK(handler.stats().processed_ == static_cast<std::uint64_t>(kThreads * kLines));
+
+        for (const std::string &id : threadIds) {
+            std::string path = root + "/";
+            append_shard_path(path, "threads.log", id);
+            paths.push_back(path);
+        }
+    }
+
+    std::error_code ec;
+    const std::vector<std::string> lines = merge(paths, ec);
+    CHECK(!ec);
+    CHECK(lines.size() == kThreads * kLines);
+    std::vector<int> next(kThreads, 0);
+    for (const std::string &line : lines) {
+        int t = -1;
+        int i = -1;
+        CHECK(std::sscanf(line.c_str(), "%d %d", &t, &i) == 2);
+        CHECK(t >= 0 && t < kThreads);
+        CHECK(i == next[t]);
+        ++next[t];
+    }
+
+    for (const std::string &path : paths) {
+        std::remove(path.c_str());
+    }
+    std::remove(root.c_str());
+}
+
+} // namespace
+
+int main()
+{
+    test_merge();
+    test_thread_shards();
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "shm_ring.hpp"
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.hpp"
+#include "logger.hpp"
+#include "platform.hpp"
+
+using namespace tslogger;
+
+namespace
+{
+
+constexpr int kProducers = 4;
+constexpr int kMessagesPerProducer = 20000;
+
+Message make_message(int producer, int seq)
+{
+    Message msg;
+    msg.logLevel_ = producer % 2 == 0 ? INFO : ERROR;
+    msg.message_ = std::to_string(producer) + " " + std::to_string(seq);
+    msg.threadId_ = this_thread_id();
+    msg.filename_ = "ring.log";
+    msg.category_ = "producer" + std::to_string(producer);
+    msg.format_ = LINE_FORMAT_LEVEL_ONLY;
+    msg.flags_ = 0;
+    msg.timestamp_ = 0;
+    msg.timestampNs_ = static_cast<std::uint64_t>(seq);
+    return msg;
+}
+
+// Producers push concurrently into a ring much smaller than the traffic, so
+// it wraps many times; every message is popped once, intact and in the
+// order its producer pushed it
+void test_round_trip()
+{
+    const std::string path = test_path("test_shm_ring");
+    std::remove(path.c_str());
+
+    std::error_code ec;
+    ShmRing ring(path.c_str(), 1 << 16, ec);
+    CHECK(!ec);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < kProducers; ++p) {
+        producers.emplace_back([&ring, p] {
+            for (int i = 0; i < kMessagesPerProducer; ++i) {
+                const Message msg = make_message(p, i);
+                while (!ring.push(msg)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<int> next(kProducers, 0);
+    int popped = 0;
+    Message msg;
+    while (popped < kProducers * kMessagesPerProducer) {
+        if (!ring.pop(msg)) {
+            std::this_thread::yield();
+            continue;
+        }
+        int producer = -1;
+        int seq = -1;
+        CHECK(std::sscanf(msg.message_.c_str(), "%d %d", &producer, &seq) == 2);
+        CHECK(producer >= 0 && producer < kProducers);
+        CHECK(seq == next[producer]);
+        const Message expected = make_message(producer, seq);
+        CHECK(msg.message_ == expected.message_);
+        CHECK(msg.logLevel_ == expected.logLevel_);
+        CHECK(msg.filename_ == expected.filename_);
+        CHECK(msg.category_ == expected.category_);
+        CHECK(msg.timestampNs_ == expected.timestampNs_);
+        ++next[producer];
+        ++popped;
+    }
+
+    for (auto &t : producers) {
+        t.join();
+    }
+    CHECK(!ring.pop(msg));
+    CHECK(ring.pending() == 0);
+
+    std::remove(path.c_str());
+}
+
+// The positions of a ring, laid out as ShmRingHeader in src/shm_ring.cpp
+struct RingPositions {
+    std::atomic<std::uint64_t> *head_;
+    std::atomic<std::uint64_t> *tail_;
+};
+
+// A producer that dies right after moving the head, before storing its
+// record word, leaves zeroed space: the drain skips it once, then pops the
+// records pushed after it, also when the space runs over the end of the
+// data area
+void test_dead_producer()
+{
+    constexpr std::size_t kCapacity = 4096;
+    const std::string path = test_path("test_shm_ring_dead");
+    std::remove(path.c_str());
+
+    std::error_code ec;
+    ShmRing ring(path.c_str(), kCapacity, ec);
+    CHECK(!ec);
+    std::size_t size = 0;
+    void *addr = platform::map_shared_file(path, size, ec);
+    CHECK(addr != nullptr);
+    RingPositions positions{reinterpret_cast<std::atomic<std::uint64_t> *>(static_cast<char *>(addr) + 64),
+        reinterpret_cast<std::atomic<std::uint64_t> *>(static_cast<char *>(addr) + 128)};
+
+    Message msg;
+    CHECK(ring.push(make_message(0, 0)));
+    positions.head_->fetch_add(128);
+    CHECK(ring.push(make_message(0, 1)));
+    CHECK(ring.pop(msg) && msg.message_ == "0 0");
+    CHECK(!ring.pop(msg));
+    CHECK(ring.skip_reserved());
+    CHECK(ring.pop(msg) && msg.message_ == "0 1");
+    CHECK(!ring.pop(msg));
+    CHECK(ring.pending() == 0);
+
+    // Dead as the last producer: nothing stored after it
+    positions.head_->fetch_add(64);
+    CHECK(!ring.pop(msg));
+    CHECK(ring.skip_reserved());
+    CHECK(ring.pending() == 0);
+
+    // Dead with padding: 64 bytes up to the end of the data area and the
+    // record from its start
+    positions.tail_->store(5 * kCapacity - 64);
+    positions.head_->store(5 * kCapacity - 64 + 64 + 128);
+    CHECK(ring.push(make_message(0, 2)));
+    CHECK(!ring.pop(msg));
+    CHECK(ring.skip_reserved());
+    CHECK(ring.pop(msg) && msg.message_ == "0 2");
+    CHECK(ring.pending() == 0);
+    CHECK(!ring.skip_reserved());
+
+    platform::unmap_file(addr, size);
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main()
+{
+    test_round_trip();
+    test_dead_producer();
+    return 0;
+}
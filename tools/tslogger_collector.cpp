@@ -0,0 +1,375 @@
+#include "platform.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Host-wide collector for the Handler collector sink (Handler::collector()).
+// Every process sends framed file lines over a Unix domain socket; this
+// process appends them to files under its root directory, buffers the
+// writes, flushes them periodically and rotates files by size.
+
+namespace
+{
+
+constexpr std::size_t kFrameHeader = 2 * sizeof(std::uint32_t);
+constexpr std::size_t kReadSize = 256 * 1024;
+// Reads of one client per poll round, so that a fast client neither
+// starves the others nor piles up unparsed input
+constexpr int kReadsPerPoll = 4;
+// A frame larger than this is a protocol error and closes the client
+constexpr std::size_t kMaxFrame = 16 << 20;
+
+struct Options {
+    std::string socket;
+    std::string root = "log";
+    // Rotate a file once it grows past this size, 0 never rotates
+    std::size_t maxFileBytes = 64 << 20;
+    // Rotated files kept as name.1 ... name.N
+    unsigned keep = 5;
+    std::chrono::milliseconds flushInterval{200};
+    std::size_t bufferBytes = 64 * 1024;
+};
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void on_signal(int)
+{
+    g_stop = 1;
+}
+
+bool write_all(int fd, const char *data, std::size_t size)
+{
+    while (size != 0) {
+        const ssize_t written = ::write(fd, data, size);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<std::size_t>(written);
+    }
+    return true;
+}
+
+class OutputFile {
+public:
+    OutputFile(std::string path, const Options &opt)
+        : m_path_{std::move(path)},
+          m_opt_{opt},
+          m_fd_{-1},
+          m_size_{0}
+    {
+    }
+
+    ~OutputFile()
+    {
+        flush();
+        if (m_fd_ != -1) {
+            ::close(m_fd_);
+        }
+    }
+
+    OutputFile(const OutputFile &) = delete;
+    OutputFile &operator=(const OutputFile &) = delete;
+
+    void append(const char *data, std::size_t size)
+    {
+        m_buffer_.append(data, size);
+        if (m_buffer_.size() >= m_opt_.bufferBytes) {
+            flush();
+        }
+    }
+
+    void flush()
+    {
+        if (m_buffer_.empty() || !open()) {
+            return;
+        }
+        if (!write_all(m_fd_, m_buffer_.data(), m_buffer_.size())) {
+            std::cerr << "Unable to write " << m_path_ << ": " << std::strerror(errno) << "\n";
+        }
+        m_size_ += m_buffer_.size();
+        m_buffer_.clear();
+        if (m_opt_.maxFileBytes != 0 && m_size_ >= m_opt_.maxFileBytes) {
+            rotate();
+        }
+    }
+
+private:
+    bool open()
+    {
+        if (m_fd_ != -1) {
+            return true;
+        }
+        const std::size_t slash = m_path_.rfind('/');
+        if (slash != std::string::npos) {
+            std::error_code ec;
+            tslogger::platform::create_directories(m_path_.substr(0, slash), ec);
+        }
+        m_fd_ = ::open(m_path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (m_fd_ == -1) {
+            std::cerr << "Unable to open " << m_path_ << ": " << std::strerror(errno) << "\n";
+            m_buffer_.clear();
+            return false;
+        }
+        struct stat st = {};
+        m_size_ = ::fstat(m_fd_, &st) == 0 ? static_cast<std::size_t>(st.st_size) : 0;
+        return true;
+    }
+
+    // name.N-1 -> name.N, ..., name -> name.1
+    void rotate()
+    {
+        ::close(m_fd_);
+        m_fd_ = -1;
+        if (m_opt_.keep == 0) {
+            ::unlink(m_path_.c_str());
+        } else {
+            for (unsigned i = m_opt_.keep; i > 1; --i) {
+                ::rename((m_path_ + "." + std::to_string(i - 1)).c_str(), (m_path_ + "." + std::to_string(i)).c_str());
+            }
+            ::rename(m_path_.c_str(), (m_path_ + ".1").c_str());
+        }
+        m_size_ = 0;
+    }
+
+private:
+    const std::string m_path_;
+    const Options &m_opt_;
+    int m_fd_;
+    std::size_t m_size_;
+    std::string m_buffer_;
+};
+
+class Collector {
+public:
+    explicit Collector(const Options &opt)
+        : m_opt_{opt}
+    {
+    }
+
+    // Parses the complete frames of a client buffer, keeps the incomplete tail
+    bool consume(std::string &in)
+    {
+        std::size_t pos = 0;
+        while (in.size() - pos >= kFrameHeader) {
+            std::uint32_t sizes[2];
+            std::memcpy(sizes, in.data() + pos, sizeof(sizes));
+            const std::size_t frame = kFrameHeader + sizes[0] + sizes[1];
+            if (frame > kMaxFrame) {
+                return false;
+            }
+            if (in.size() - pos < frame) {
+                break;
+            }
+            const std::string filename(in.data() + pos + kFrameHeader, sizes[0]);
+            if (!valid_filename(filename)) {
+                return false;
+            }
+            file(filename).append(in.data() + pos + kFrameHeader + sizes[0], sizes[1]);
+            pos += frame;
+        }
+        in.erase(0, pos);
+        return true;
+    }
+
+    void flush()
+    {
+        for (auto &entry : m_files_) {
+            entry.second->flush();
+        }
+    }
+
+private:
+    // Relative paths without ".." components only, the clients cannot write
+    // outside the root directory
+    static bool valid_filename(const std::string &filename)
+    {
+        if (filename.empty() || filename.front() == '/') {
+            return false;
+        }
+        std::size_t start = 0;
+        while (start <= filename.size()) {
+            std::size_t end = filename.find('/', start);
+            if (end == std::string::npos) {
+                end = filename.size();
+            }
+            if (filename.compare(start, end - start, "..") == 0) {
+                return false;
+            }
+            start = end + 1;
+        }
+        return true;
+    }
+
+    OutputFile &file(const std::string &filename)
+    {
+        auto it = m_files_.find(filename);
+        if (it == m_files_.end()) {
+            it = m_files_.emplace(filename, std::make_unique<OutputFile>(m_opt_.root + "/" + filename, m_opt_)).first;
+        }
+        return *it->second;
+    }
+
+private:
+    const Options &m_opt_;
+    std::map<std::string, std::unique_ptr<OutputFile>> m_files_;
+};
+
+int listen_unix(const std::string &path)
+{
+    sockaddr_un addr = {};
+    if (path.size() >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    const int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    // A socket file left by a previous collector is replaced
+    ::unlink(path.c_str());
+    if (::bind(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) == -1 || ::listen(fd, 128) == -1) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-s" || arg == "--socket")) {
+            opt.socket = argv[++i];
+        } else if (i + 1 < argc && (arg == "-r" || arg == "--root")) {
+            opt.root = argv[++i];
+        } else if (i + 1 < argc && (arg == "-m" || arg == "--max-file-bytes")) {
+            opt.maxFileBytes = std::strtoul(argv[++i], nullptr, 10);
+        } else if (i + 1 < argc && (arg == "-k" || arg == "--keep")) {
+            opt.keep = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && (arg == "-f" || arg == "--flush-ms")) {
+            opt.flushInterval = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return !opt.socket.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " -s socket_path [-r root_dir] [-m max_file_bytes] [-k keep] [-f flush_ms]\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    if (!tslogger::platform::create_directories(opt.root, ec)) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+    const int listenFd = listen_unix(opt.socket);
+    if (listenFd == -1) {
+        std::cerr << "Unable to listen on " << opt.socket << ": " << std::strerror(errno) << "\n";
+        return 1;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    Collector collector(opt);
+    // Client sockets and their unparsed input
+    std::vector<std::pair<int, std::string>> clients;
+    std::vector<pollfd> fds;
+    std::vector<char> chunk(kReadSize);
+    auto nextFlush = std::chrono::steady_clock::now() + opt.flushInterval;
+
+    while (!g_stop) {
+        fds.assign(1, pollfd{listenFd, POLLIN, 0});
+        for (const auto &client : clients) {
+            fds.push_back(pollfd{client.first, POLLIN, 0});
+        }
+        const auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(nextFlush - std::chrono::steady_clock::now());
+        ::poll(fds.data(), fds.size(), wait.count() > 0 ? static_cast<int>(wait.count()) : 0);
+
+        if (fds[0].revents & POLLIN) {
+            for (;;) {
+                const int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd == -1) {
+                    break;
+                }
+                clients.emplace_back(fd, std::string());
+            }
+        }
+
+        for (std::size_t i = 1; i < fds.size(); ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            // Input left after the budget is still readable at the next poll
+            auto &client = clients[i - 1];
+            bool open = true;
+            for (int reads = 0; open && reads < kReadsPerPoll;) {
+                const ssize_t n = ::read(client.first, chunk.data(), chunk.size());
+                if (n > 0) {
+                    client.second.append(chunk.data(), static_cast<std::size_t>(n));
+                    open = collector.consume(client.second);
+                    ++reads;
+                    continue;
+                }
+                if (n == -1 && errno == EINTR) {
+                    continue;
+                }
+                open = (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+                break;
+            }
+            if (!open) {
+                ::close(client.first);
+                client.first = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(),
+            [](const auto &client) { return client.first == -1; }), clients.end());
+
+        if (std::chrono::steady_clock::now() >= nextFlush) {
+            collector.flush();
+            nextFlush = std::chrono::steady_clock::now() + opt.flushInterval;
+        }
+    }
+
+    collector.flush();
+    for (const auto &client : clients) {
+        ::close(client.first);
+    }
+    ::close(listenFd);
+    ::unlink(opt.socket.c_str());
+    return 0;
+}
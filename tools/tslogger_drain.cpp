@@ -0,0 +1,122 @@
+#include "logger.hpp"
+
+#include <csignal>
+#include <cstdlib>
+#include <string>
+
+using namespace tslogger;
+
+// Drains a shared-memory ring written by Loggers constructed with a ShmRing
+// and writes the messages through an ordinary Handler. Rendering and file
+// I/O happen here, not in the application.
+
+namespace
+{
+
+struct Options {
+    std::string ring;
+    std::string root = "log";
+    std::size_t capacity = 4 << 20;
+    log_level_t maxLevel = DEBUG;
+    bool untilEmpty = false;
+    // A record reserved but not committed for this long is skipped
+    std::chrono::milliseconds stallTimeout{1000};
+};
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void on_signal(int)
+{
+    g_stop = 1;
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-i" || arg == "--ring")) {
+            opt.ring = argv[++i];
+        } else if (i + 1 < argc && (arg == "-r" || arg == "--root")) {
+            opt.root = argv[++i];
+        } else if (i + 1 < argc && (arg == "-s" || arg == "--size")) {
+            opt.capacity = std::strtoul(argv[++i], nullptr, 10);
+        } else if (i + 1 < argc && (arg == "-l" || arg == "--level")) {
+            opt.maxLevel = static_cast<log_level_t>(std::strtoul(argv[++i], nullptr, 10));
+        } else if (i + 1 < argc && (arg == "-t" || arg == "--stall-ms")) {
+            opt.stallTimeout = std::chrono::milliseconds(std::strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-x" || arg == "--exit-when-empty") {
+            opt.untilEmpty = true;
+        } else {
+            return false;
+        }
+    }
+    return !opt.ring.empty() && opt.maxLevel <= DEBUG;
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " -i ring_file [-r root_dir] [-s ring_bytes] [-l max_level] [-t stall_ms] [-x]\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    ShmRing ring(opt.ring.c_str(), opt.capacity, ec);
+    if (ec.value()) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+    Handler handler(opt.root.c_str(), opt.maxLevel, std::clog, ec);
+    if (ec.value()) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+
+    std::signal(SIGINT, on_signal);
+    std::signal(SIGTERM, on_signal);
+
+    auto queue = handler.get_queue_ptr();
+    auto stalledSince = std::chrono::steady_clock::now();
+    std::size_t stalledAt = 0;
+    Message msg;
+    for (;;) {
+        std::size_t popped = 0;
+        while (popped < Handler::kBatchSize && ring.pop(msg)) {
+            queue->push(std::move(msg));
+            msg = Message();
+            ++popped;
+        }
+        if (popped != 0) {
+            handler.process();
+            continue;
+        }
+
+        // Nothing to pop: either the ring is empty, or the oldest record is
+        // still being written, or its producer died while writing it
+        const std::size_t pending = ring.pending();
+        const auto now = std::chrono::steady_clock::now();
+        if (pending == 0) {
+            if (opt.untilEmpty || g_stop) {
+                break;
+            }
+        } else if (pending != stalledAt) {
+            stalledAt = pending;
+            stalledSince = now;
+        } else if (now - stalledSince >= opt.stallTimeout && ring.skip_reserved()) {
+            std::cerr << "Skipped a record that was never committed\n";
+            stalledAt = 0;
+        } else if (g_stop) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (ring.dropped() != 0) {
+        std::cerr << ring.dropped() << " messages were dropped because the ring was full\n";
+    }
+    return 0;
+}
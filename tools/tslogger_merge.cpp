@@ -0,0 +1,89 @@
+#include "log_shard.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace tslogger;
+
+// Merges the per-thread shards of a log file, written with
+// Handler::thread_shards(), into one stream ordered by message time
+
+namespace
+{
+
+struct Options {
+    std::vector<std::string> shards;
+    std::string output;
+    bool stats = false;
+};
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-o" || arg == "--output")) {
+            opt.output = argv[++i];
+        } else if (arg == "-s" || arg == "--stats") {
+            opt.stats = true;
+        } else if (arg[0] != '-') {
+            opt.shards.push_back(arg);
+        } else {
+            return false;
+        }
+    }
+    return !opt.shards.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0] << " shard... [-o output_file] [-s]\n"
+                  << "e.g. " << argv[0] << " log_dir/app.log.*.shard -o app.log\n";
+        return 1;
+    }
+
+    std::ofstream file;
+    if (!opt.output.empty()) {
+        file.open(opt.output, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "ERROR: cannot open " << opt.output << "\n";
+            return 1;
+        }
+    }
+    std::ostream &out = opt.output.empty() ? std::cout : file;
+
+    std::string buffer;
+    std::error_code ec;
+    std::vector<std::string> failed;
+    const std::size_t merged = merge_log_shards(opt.shards, [&out, &buffer](std::string_view line) {
+        buffer.append(line);
+        if (buffer.size() >= 64 * 1024) {
+            out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            buffer.clear();
+        }
+    }, ec, &failed);
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+    out.flush();
+
+    if (opt.stats) {
+        std::cerr << merged << " records from " << opt.shards.size() << " shards\n";
+    }
+    if (ec.value()) {
+        // The other shards were merged to the end
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        for (const std::string &path : failed) {
+            std::cerr << "  shard left out from its error on: " << path << "\n";
+        }
+        return 1;
+    }
+    if (!out) {
+        std::cerr << "ERROR: write failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "log_index.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+
+using namespace tslogger;
+
+// Prints the lines of a log file that match a level set and a time range,
+// reading only the blocks its sidecar index points to
+
+namespace
+{
+
+struct Options {
+    std::string log;
+    LogQuery query;
+    bool stats = false;
+};
+
+bool parse_levels(const std::string &list, std::uint32_t &levels)
+{
+    static const char *const kNames[] = {"ERROR", "WARNING", "INFO", "DEBUG"};
+    levels = 0;
+    std::size_t start = 0;
+    while (start <= list.size()) {
+        std::size_t end = list.find(',', start);
+        if (end == std::string::npos) {
+            end = list.size();
+        }
+        const std::string name = list.substr(start, end - start);
+        bool known = false;
+        for (std::uint32_t i = 0; i < 4; ++i) {
+            if (name == kNames[i]) {
+                levels |= 1u << i;
+                known = true;
+            }
+        }
+        if (!known) {
+            return false;
+        }
+        start = end + 1;
+    }
+    return levels != 0;
+}
+
+// "YYYY-MM-DD HH:MM:SS" in local time, or nanoseconds since the epoch
+bool parse_time(const std::string &text, std::uint64_t &ns)
+{
+    std::tm tm = {};
+    if (std::sscanf(text.c_str(), "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+            &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        const std::time_t t = std::mktime(&tm);
+        if (t < 0) {
+            return false;
+        }
+        ns = static_cast<std::uint64_t>(t) * 1000000000;
+        return true;
+    }
+    char *end = nullptr;
+    ns = std::strtoull(text.c_str(), &end, 10);
+    return end != text.c_str() && *end == '\0';
+}
+
+bool parse_options(int argc, char **argv, Options &opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (i + 1 < argc && (arg == "-l" || arg == "--levels")) {
+            if (!parse_levels(argv[++i], opt.query.levels_)) {
+                return false;
+            }
+        } else if (i + 1 < argc && (arg == "-f" || arg == "--from")) {
+            if (!parse_time(argv[++i], opt.query.fromNs_)) {
+                return false;
+            }
+        } else if (i + 1 < argc && (arg == "-t" || arg == "--to")) {
+            if (!parse_time(argv[++i], opt.query.toNs_)) {
+                return false;
+            }
+            // A time given to the second covers that whole second
+            if (opt.query.toNs_ % 1000000000 == 0) {
+                opt.query.toNs_ += 999999999;
+            }
+        } else if (arg == "-s" || arg == "--stats") {
+            opt.stats = true;
+        } else if (opt.log.empty() && arg[0] != '-') {
+            opt.log = arg;
+        } else {
+            return false;
+        }
+    }
+    return !opt.log.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    if (!parse_options(argc, argv, opt)) {
+        std::cerr << "Usage: " << argv[0]
+                  << " log_file [-l ERROR,WARNING] [-f \"YYYY-MM-DD HH:MM:SS\"|ns] [-t \"YYYY-MM-DD HH:MM:SS\"|ns] [-s]\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    LogIndexReader reader(opt.log.c_str(), ec);
+    if (ec.value()) {
+        std::cerr << "ERROR:(" << ec.value() << ") " << ec.message() << "\n";
+        return 1;
+    }
+
+    std::string out;
+    const std::size_t found = reader.query(opt.query, [&out](std::string_view line) {
+        out.append(line);
+        out.push_back('\n');
+        if (out.size() >= 64 * 1024) {
+            std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+            out.clear();
+        }
+    });
+    std::cout.write(out.data(), static_cast<std::streamsize>(out.size()));
+
+    if (opt.stats) {
+        std::cerr << found << " lines, " << reader.blocks() << " indexed blocks, "
+                  << reader.scanned_bytes() << " bytes scanned\n";
+    }
+    return 0;
+}